@@ -1,12 +1,319 @@
 #include <stdio.h>
 #include <string.h>
 #include <stddef.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <errno.h>
+#include <pthread.h>
 
 #include <list>
+#include <algorithm>
+#include <iterator>
 
 #include "fat.h"
 #include "fat_file.h"
 
+// Block 0 starts with the magic, block_size, block_count, stripe count and
+// generation, followed by block_map.
+const int FAT_HEADER_SIZE = 5 * sizeof(int);
+const int FAT_GENERATION_OFFSET = 4 * sizeof(int);
+
+// Multi-block transfers smaller than this are not worth a thread per stripe.
+const int FAT_PARALLEL_MIN_SIZE = 64 * 1024;
+
+// Direct I/O needs buffer addresses, file offsets and sizes aligned to this.
+const int FAT_DIRECT_ALIGNMENT = 4096;
+// Size of the aligned buffers in the direct I/O pool.
+const int FAT_DIRECT_BUFFER_SIZE = 64 * 1024;
+
+/**
+ * Find the disk file and byte position holding block_offset of a block.
+ * Blocks are striped round-robin over the disk files: block b is block
+ * b / stripe_count of file b % stripe_count.
+ * @return descriptor of the disk file
+ */
+static int mini_fat_locate_block(const FAT_FILESYSTEM *fs, const int block_id, const int block_offset, off_t * position) {
+	int stripes = fs->stripe_fds.size();
+	*position = (off_t)(block_id / stripes) * fs->block_size + block_offset;
+	return fs->stripe_fds[block_id % stripes];
+}
+
+// Bytes from block_offset of a block (up to size) that are contiguous in one disk file.
+static int mini_fat_contiguous_span(const FAT_FILESYSTEM *fs, const int block_offset, const int size) {
+	if (fs->stripe_fds.size() == 1 || block_offset + size <= fs->block_size)
+		return size;
+	return fs->block_size - block_offset;
+}
+
+static bool mini_fat_is_aligned(const void * buffer, const off_t position, const size_t size) {
+	return ((uintptr_t)buffer | (uintptr_t)position | size) % FAT_DIRECT_ALIGNMENT == 0;
+}
+
+static off_t mini_fat_align_up(const off_t value) {
+	return (value + FAT_DIRECT_ALIGNMENT - 1) / FAT_DIRECT_ALIGNMENT * FAT_DIRECT_ALIGNMENT;
+}
+
+// Take an aligned buffer of FAT_DIRECT_BUFFER_SIZE bytes from the pool of the disk.
+static char * mini_fat_get_buffer(FAT_FILESYSTEM *fs) {
+	char * buffer = NULL;
+	pthread_mutex_lock(&fs->buffer_lock);
+	if (!fs->direct_buffers.empty()) {
+		buffer = fs->direct_buffers.back();
+		fs->direct_buffers.pop_back();
+	}
+	pthread_mutex_unlock(&fs->buffer_lock);
+	if (buffer == NULL && posix_memalign((void **)&buffer, FAT_DIRECT_ALIGNMENT, FAT_DIRECT_BUFFER_SIZE) != 0)
+		return NULL;
+	return buffer;
+}
+
+static void mini_fat_put_buffer(FAT_FILESYSTEM *fs, char * buffer) {
+	pthread_mutex_lock(&fs->buffer_lock);
+	fs->direct_buffers.push_back(buffer);
+	pthread_mutex_unlock(&fs->buffer_lock);
+}
+
+/**
+ * pread from a disk file. In direct I/O mode, unaligned requests are read
+ * window by window into aligned buffers of the pool and copied out.
+ */
+static ssize_t mini_fat_file_pread(FAT_FILESYSTEM *fs, const int fd, void * buffer, const size_t size, const off_t position) {
+	if (!fs->direct_io || mini_fat_is_aligned(buffer, position, size))
+		return pread(fd, buffer, size, position);
+	char * bounce = mini_fat_get_buffer(fs);
+	if (bounce == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	size_t done = 0;
+	bool is_failed = false;
+	while (done < size) {
+		off_t start = position + done;
+		off_t window = start - start % FAT_DIRECT_ALIGNMENT;
+		size_t skip = start - window;
+		size_t chunk = std::min(size - done, FAT_DIRECT_BUFFER_SIZE - skip);
+		ssize_t n = pread(fd, bounce, mini_fat_align_up(skip + chunk), window);
+		if (n < 0)
+			is_failed = true;
+		if (n <= (ssize_t)skip)
+			break; // Error or end of file.
+		size_t available = std::min(chunk, (size_t)n - skip);
+		memcpy((char *)buffer + done, bounce + skip, available);
+		done += available;
+		if (available < chunk)
+			break;
+	}
+	mini_fat_put_buffer(fs, bounce);
+	return is_failed && done == 0 ? -1 : (ssize_t)done;
+}
+
+// Lock guarding read-modify-write of the sector at position of a disk file.
+static pthread_mutex_t * mini_fat_sector_lock(FAT_FILESYSTEM *fs, const int fd, const off_t position) {
+	unsigned long long sector = position / FAT_DIRECT_ALIGNMENT;
+	return &fs->direct_locks[(sector * 31 + fd) % FAT_DIRECT_LOCK_COUNT];
+}
+
+/**
+ * pwrite to a disk file. In direct I/O mode, unaligned requests go through
+ * aligned buffers of the pool; sectors only partly covered at the edges are
+ * read first, under the locks of those sectors so that concurrent edge
+ * updates of the same sector do not undo each other. Writes to other
+ * sectors go on in parallel.
+ */
+static ssize_t mini_fat_file_pwrite(FAT_FILESYSTEM *fs, const int fd, const void * buffer, const size_t size, const off_t position) {
+	if (!fs->direct_io || mini_fat_is_aligned(buffer, position, size))
+		return pwrite(fd, buffer, size, position);
+	char * bounce = mini_fat_get_buffer(fs);
+	if (bounce == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	size_t done = 0;
+	bool is_failed = false;
+	while (done < size) {
+		off_t start = position + done;
+		off_t window = start - start % FAT_DIRECT_ALIGNMENT;
+		size_t skip = start - window;
+		size_t chunk = std::min(size - done, FAT_DIRECT_BUFFER_SIZE - skip);
+		size_t window_size = mini_fat_align_up(skip + chunk);
+		size_t last_sector = window_size - FAT_DIRECT_ALIGNMENT;
+
+		// Only the edge sectors are read back; lock them in address order,
+		// so two writes sharing both locks cannot deadlock.
+		pthread_mutex_t * first_lock = skip > 0 ? mini_fat_sector_lock(fs, fd, window) : NULL;
+		pthread_mutex_t * last_lock = skip + chunk < window_size ? mini_fat_sector_lock(fs, fd, window + last_sector) : NULL;
+		if (last_lock == first_lock)
+			last_lock = NULL;
+		else if (first_lock && last_lock < first_lock)
+			std::swap(first_lock, last_lock);
+		if (first_lock)
+			pthread_mutex_lock(first_lock);
+		if (last_lock)
+			pthread_mutex_lock(last_lock);
+
+		// Sectors past the end of the disk file read short; they stay zero.
+		if (skip > 0) {
+			memset(bounce, 0, FAT_DIRECT_ALIGNMENT);
+			is_failed = pread(fd, bounce, FAT_DIRECT_ALIGNMENT, window) < 0;
+		}
+		if (!is_failed && skip + chunk < window_size && (skip == 0 || last_sector > 0)) {
+			memset(bounce + last_sector, 0, FAT_DIRECT_ALIGNMENT);
+			is_failed = pread(fd, bounce + last_sector, FAT_DIRECT_ALIGNMENT, window + last_sector) < 0;
+		}
+		ssize_t n = -1;
+		if (!is_failed) {
+			memcpy(bounce + skip, (const char *)buffer + done, chunk);
+			n = pwrite(fd, bounce, window_size, window);
+		}
+
+		if (last_lock)
+			pthread_mutex_unlock(last_lock);
+		if (first_lock)
+			pthread_mutex_unlock(first_lock);
+		if (is_failed)
+			break;
+		if (n < (ssize_t)(skip + chunk)) {
+			is_failed = n < 0;
+			done += n > (ssize_t)skip ? n - skip : 0;
+			break;
+		}
+		done += chunk;
+	}
+	mini_fat_put_buffer(fs, bounce);
+	return is_failed && done == 0 ? -1 : (ssize_t)done;
+}
+
+static bool mini_fat_is_stale(FAT_FILESYSTEM *fs, const int replica) {
+	pthread_mutex_lock(&fs->replica_lock);
+	bool is_stale = fs->replicas[replica].is_stale;
+	pthread_mutex_unlock(&fs->replica_lock);
+	return is_stale;
+}
+
+/**
+ * Mark a replica stale, remembering the blocks of [position, position +
+ * size) for the next resync, or every block if size is negative. When a
+ * replica first falls behind, the generation of the others is bumped on
+ * disk, so a later mini_fat_load_mirrored still knows it is behind.
+ */
+static void mini_fat_miss_blocks(FAT_FILESYSTEM *fs, const int replica, const off_t position, const ssize_t size) {
+	pthread_mutex_lock(&fs->replica_lock);
+	FAT_REPLICA * stale = &fs->replicas[replica];
+	if ((int)stale->missed_blocks.size() < fs->block_count)
+		stale->missed_blocks.resize(fs->block_count, false);
+	for (off_t i=position / fs->block_size; size > 0 && i <= (position + size - 1) / fs->block_size && i < fs->block_count; ++i) {
+		stale->missed_blocks[i] = true;
+	}
+	if (size < 0)
+		stale->missed_blocks.assign(fs->block_count, true);
+
+	if (!stale->is_stale) {
+		stale->is_stale = true;
+		fs->generation++;
+		for (int i=0; i<(int)fs->replicas.size(); ++i) {
+			if (!fs->replicas[i].is_stale)
+				mini_fat_file_pwrite(fs, fs->replicas[i].fd, &fs->generation, sizeof(fs->generation), FAT_GENERATION_OFFSET);
+		}
+	}
+	pthread_mutex_unlock(&fs->replica_lock);
+}
+
+// Take the in-sync replica with the fewest reads in progress, or -1.
+static int mini_fat_pick_replica(FAT_FILESYSTEM *fs) {
+	int best = -1;
+	pthread_mutex_lock(&fs->replica_lock);
+	for (int i=0; i<(int)fs->replicas.size(); ++i) {
+		const FAT_REPLICA &replica = fs->replicas[i];
+		if (!replica.is_stale && (best == -1 || replica.queue_depth < fs->replicas[best].queue_depth))
+			best = i;
+	}
+	if (best != -1)
+		fs->replicas[best].queue_depth++;
+	pthread_mutex_unlock(&fs->replica_lock);
+	return best;
+}
+
+static void mini_fat_release_replica(FAT_FILESYSTEM *fs, const int replica) {
+	pthread_mutex_lock(&fs->replica_lock);
+	fs->replicas[replica].queue_depth--;
+	pthread_mutex_unlock(&fs->replica_lock);
+}
+
+// First in-sync replica, or -1.
+static int mini_fat_first_replica(FAT_FILESYSTEM *fs) {
+	for (int i=0; i<(int)fs->replicas.size(); ++i) {
+		if (!mini_fat_is_stale(fs, i))
+			return i;
+	}
+	return -1;
+}
+
+// Descriptors of all copies of a disk file: the replicas of a mirrored disk, or fd itself.
+static std::vector<int> mini_fat_replica_fds(const FAT_FILESYSTEM *fs, const int fd) {
+	std::vector<int> fds;
+	for (int i=0; i<(int)fs->replicas.size(); ++i) {
+		fds.push_back(fs->replicas[i].fd);
+	}
+	if (fds.empty())
+		fds.push_back(fd);
+	return fds;
+}
+
+/**
+ * pread from a disk file. On mirrored disks the read goes to the in-sync
+ * replica with the fewest reads in progress; a replica that fails is
+ * dropped until the next resync and the read is retried on another.
+ */
+static ssize_t mini_fat_disk_pread(FAT_FILESYSTEM *fs, const int fd, void * buffer, const size_t size, const off_t position) {
+	if (fs->replicas.empty())
+		return mini_fat_file_pread(fs, fd, buffer, size, position);
+	for (;;) {
+		int replica = mini_fat_pick_replica(fs);
+		if (replica == -1) {
+			errno = EIO;
+			return -1;
+		}
+		ssize_t n = mini_fat_file_pread(fs, fs->replicas[replica].fd, buffer, size, position);
+		mini_fat_release_replica(fs, replica);
+		if (n >= 0)
+			return n;
+		perror("Cannot read replica, dropping it until resync");
+		mini_fat_miss_blocks(fs, replica, 0, -1);
+	}
+}
+
+/**
+ * pwrite to a disk file. On mirrored disks the data goes to every in-sync
+ * replica; replicas that are stale or fail remember the blocks for the next
+ * resync. The write succeeds if one replica took all of it.
+ */
+static ssize_t mini_fat_disk_pwrite(FAT_FILESYSTEM *fs, const int fd, const void * buffer, const size_t size, const off_t position) {
+	if (fs->replicas.empty())
+		return mini_fat_file_pwrite(fs, fd, buffer, size, position);
+	ssize_t written = -1;
+	for (int i=0; i<(int)fs->replicas.size(); ++i) {
+		ssize_t n = -1;
+		if (!mini_fat_is_stale(fs, i)) {
+			n = mini_fat_file_pwrite(fs, fs->replicas[i].fd, buffer, size, position);
+			if (n < (ssize_t)size)
+				fprintf(stderr, "Cannot write replica '%s', dropping it until resync.\n", fs->replicas[i].filename);
+		}
+		if (n < (ssize_t)size)
+			mini_fat_miss_blocks(fs, i, position, size);
+		else
+			written = n;
+	}
+	if (written < 0)
+		errno = EIO;
+	return written;
+}
 
 /**
  * Write inside one block in the filesystem.
@@ -21,10 +328,15 @@ int mini_fat_write_in_block(FAT_FILESYSTEM *fs, const int block_id, const int bl
 	assert(block_offset >= 0);
 	assert(block_offset < fs->block_size);
 	assert(size + block_offset <= fs->block_size);
+	assert(block_id >= 0 && block_id < fs->block_count);
 
-	int written = 0;
-
-	// TODO: write in the real file.
+	off_t position;
+	int fd = mini_fat_locate_block(fs, block_id, block_offset, &position);
+	int written = mini_fat_disk_pwrite(fs, fd, buffer, size, position);
+	if (written < 0) {
+		perror("Cannot write block");
+		return 0;
+	}
 
 	return written;
 }
@@ -42,39 +354,596 @@ int mini_fat_read_in_block(FAT_FILESYSTEM *fs, const int block_id, const int blo
 	assert(block_offset >= 0);
 	assert(block_offset < fs->block_size);
 	assert(size + block_offset <= fs->block_size);
+	assert(block_id >= 0 && block_id < fs->block_count);
 
-	int read = 0;
-
-	// TODO: read from the real file.
+	off_t position;
+	int fd = mini_fat_locate_block(fs, block_id, block_offset, &position);
+	int read = mini_fat_disk_pread(fs, fd, buffer, size, position);
+	if (read < 0) {
+		perror("Cannot read block");
+		return 0;
+	}
 
 	return read;
 }
 
+// Work of one thread of mini_fat_transfer_blocks: the pieces of one stripe.
+typedef struct t_FAT_STRIPE_IO {
+	FAT_FILESYSTEM * fs;
+	std::vector<FAT_BLOCK_IO*> ios;
+	bool is_write;
+} FAT_STRIPE_IO;
+
+static void * mini_fat_transfer_stripe(void * arg) {
+	FAT_STRIPE_IO * stripe = (FAT_STRIPE_IO *)arg;
+	std::vector<FAT_BLOCK_IO*> &ios = stripe->ios;
+	for (int i=0; i<(int)ios.size(); ) {
+		// Merge the following pieces that are adjacent both on disk and in memory.
+		off_t position;
+		int fd = mini_fat_locate_block(stripe->fs, ios[i]->block_id, ios[i]->block_offset, &position);
+		size_t total = ios[i]->size;
+		int end = i + 1;
+		for (; end<(int)ios.size(); ++end) {
+			off_t next_position;
+			mini_fat_locate_block(stripe->fs, ios[end]->block_id, ios[end]->block_offset, &next_position);
+			if (next_position != position + (off_t)total || ios[end]->buffer != ios[i]->buffer + total)
+				break;
+			total += ios[end]->size;
+		}
+
+		ssize_t done = stripe->is_write ? mini_fat_disk_pwrite(stripe->fs, fd, ios[i]->buffer, total, position)
+			: mini_fat_disk_pread(stripe->fs, fd, ios[i]->buffer, total, position);
+		if (done < 0) {
+			perror(stripe->is_write ? "Cannot write blocks" : "Cannot read blocks");
+			done = 0;
+		}
+		for (; i<end; ++i) {
+			ios[i]->transferred = done < ios[i]->size ? done : ios[i]->size;
+			done -= ios[i]->transferred;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Read or write several pieces of blocks at once. Pieces that follow each
+ * other both on disk and in memory are merged into one system call. On
+ * striped disks, large transfers are issued to every disk file in parallel,
+ * one thread per stripe. On mirrored disks, large reads are cut in one part
+ * per replica, read in parallel from the least busy replicas.
+ * @param  ios      pieces, each inside one block; transferred is set for each
+ * @return          bytes transferred before the first short piece
+ */
+int mini_fat_transfer_blocks(FAT_FILESYSTEM *fs, std::vector<FAT_BLOCK_IO> &ios, const bool is_write) {
+	long long total_size = 0;
+	for (int i=0; i<(int)ios.size(); ++i) {
+		assert(ios[i].block_offset >= 0 && ios[i].size + ios[i].block_offset <= fs->block_size);
+		assert(ios[i].block_id >= 0 && ios[i].block_id < fs->block_count);
+		ios[i].transferred = 0;
+		total_size += ios[i].size;
+	}
+
+	int stripes = fs->stripe_fds.size();
+	int lanes = stripes;
+	if (!is_write && fs->replicas.size() > 1 && total_size >= FAT_PARALLEL_MIN_SIZE)
+		lanes = fs->replicas.size();
+	std::vector<FAT_STRIPE_IO> work(lanes);
+	for (int i=0; i<lanes; ++i) {
+		work[i].fs = fs;
+		work[i].is_write = is_write;
+	}
+	long long assigned = 0;
+	for (int i=0; i<(int)ios.size(); ++i) {
+		int lane = stripes > 1 ? ios[i].block_id % stripes : (int)(assigned * lanes / total_size);
+		work[lane].ios.push_back(&ios[i]);
+		assigned += ios[i].size;
+	}
+
+	std::vector<pthread_t> threads;
+	for (int i=0; i<lanes; ++i) {
+		if (work[i].ios.empty())
+			continue;
+		pthread_t thread;
+		if (lanes == 1 || total_size < FAT_PARALLEL_MIN_SIZE || pthread_create(&thread, NULL, mini_fat_transfer_stripe, &work[i]) != 0)
+			mini_fat_transfer_stripe(&work[i]);
+		else
+			threads.push_back(thread);
+	}
+	for (int i=0; i<(int)threads.size(); ++i) {
+		pthread_join(threads[i], NULL);
+	}
+
+	int transferred = 0;
+	for (int i=0; i<(int)ios.size(); ++i) {
+		transferred += ios[i].transferred;
+		if (ios[i].transferred < ios[i].size)
+			break;
+	}
+	return transferred;
+}
+
+// Chunk size used when copies have to go through a user-space buffer.
+const int COPY_BUFFER_SIZE = 64 * 1024;
+
+// Whether a failed kernel copy should be retried with a slower method.
+static bool is_copy_unsupported(const int error) {
+	return error == EXDEV || error == EINVAL || error == ENOSYS || error == EOPNOTSUPP || error == EBADF;
+}
+
+/**
+ * Copy bytes between two file ranges in the kernel (copy_file_range),
+ * bouncing through a buffer only if the kernel cannot do it (or in direct
+ * I/O mode, where the page cache is kept out of the way).
+ * @return copied byte count
+ */
+static int mini_fat_file_copy(FAT_FILESYSTEM *fs, const int src_fd, loff_t src, const int dst_fd, loff_t dst, const int size) {
+	int copied = 0;
+	while (!fs->direct_io && copied < size) {
+		ssize_t n = copy_file_range(src_fd, &src, dst_fd, &dst, size - copied, 0);
+		if (n <= 0)
+			break;
+		copied += n;
+	}
+
+	std::vector<char> buffer(copied < size ? COPY_BUFFER_SIZE : 0);
+	while (copied < size) {
+		int chunk = size - copied < COPY_BUFFER_SIZE ? size - copied : COPY_BUFFER_SIZE;
+		ssize_t n = mini_fat_file_pread(fs, src_fd, &buffer[0], chunk, src);
+		if (n <= 0 || mini_fat_file_pwrite(fs, dst_fd, &buffer[0], n, dst) != n) {
+			perror("Cannot copy blocks");
+			break;
+		}
+		src += n;
+		dst += n;
+		copied += n;
+	}
+	return copied;
+}
+
+/**
+ * Copy bytes between two ranges of disk files, see mini_fat_file_copy. On
+ * mirrored disks every in-sync replica copies within itself.
+ * @return copied byte count
+ */
+static int mini_fat_kernel_copy(FAT_FILESYSTEM *fs, const int src_fd, loff_t src, const int dst_fd, loff_t dst, const int size) {
+	if (fs->replicas.empty())
+		return mini_fat_file_copy(fs, src_fd, src, dst_fd, dst, size);
+	int copied = 0;
+	for (int i=0; i<(int)fs->replicas.size(); ++i) {
+		int n = mini_fat_is_stale(fs, i) ? -1 : mini_fat_file_copy(fs, fs->replicas[i].fd, src, fs->replicas[i].fd, dst, size);
+		if (n < size)
+			mini_fat_miss_blocks(fs, i, dst, size);
+		else
+			copied = n;
+	}
+	return copied;
+}
+
+// Copy a range of one replica to the other in-sync replicas, after it was written there alone.
+static void mini_fat_mirror_range(FAT_FILESYSTEM *fs, const int source, const off_t position, const int size) {
+	for (int i=0; i<(int)fs->replicas.size(); ++i) {
+		if (i == source)
+			continue;
+		int n = mini_fat_is_stale(fs, i) ? -1 : mini_fat_file_copy(fs, fs->replicas[source].fd, position, fs->replicas[i].fd, position, size);
+		if (n < size)
+			mini_fat_miss_blocks(fs, i, position, size);
+	}
+}
+
+/**
+ * Copy bytes between two ranges of the disk without going through user
+ * space, see mini_fat_kernel_copy. Each range may span consecutive blocks;
+ * ranges must not overlap.
+ * @return copied byte count
+ */
+int mini_fat_copy_range(FAT_FILESYSTEM *fs, const int src_block, const int src_offset, const int dst_block, const int dst_offset, const int size) {
+	assert(src_block >= 0 && (off_t)src_block * fs->block_size + src_offset + size <= (off_t)fs->block_count * fs->block_size);
+	assert(dst_block >= 0 && (off_t)dst_block * fs->block_size + dst_offset + size <= (off_t)fs->block_count * fs->block_size);
+
+	int copied = 0;
+	while (copied < size) {
+		int src_block_id = src_block + (src_offset + copied) / fs->block_size;
+		int src_block_offset = (src_offset + copied) % fs->block_size;
+		int dst_block_id = dst_block + (dst_offset + copied) / fs->block_size;
+		int dst_block_offset = (dst_offset + copied) % fs->block_size;
+		int chunk = mini_fat_contiguous_span(fs, src_block_offset, size - copied);
+		chunk = mini_fat_contiguous_span(fs, dst_block_offset, chunk);
+
+		off_t src, dst;
+		int src_fd = mini_fat_locate_block(fs, src_block_id, src_block_offset, &src);
+		int dst_fd = mini_fat_locate_block(fs, dst_block_id, dst_block_offset, &dst);
+		int n = mini_fat_kernel_copy(fs, src_fd, src, dst_fd, dst, chunk);
+		copied += n;
+		if (n < chunk)
+			break;
+	}
+	return copied;
+}
+
+// Copy from a disk file to a host descriptor, see mini_fat_copy_to_fd.
+static int mini_fat_kernel_copy_to_fd(FAT_FILESYSTEM *fs, const int fd, loff_t src, const int size, const int host_fd) {
+	int copied = 0;
+	int method = fs->direct_io ? 2 : 0; // 0: copy_file_range, 1: sendfile, 2: buffer.
+	std::vector<char> buffer;
+	while (copied < size) {
+		ssize_t n;
+		if (method == 0) {
+			n = copy_file_range(fd, &src, host_fd, NULL, size - copied, 0);
+		} else if (method == 1) {
+			off_t offset = src;
+			n = sendfile(host_fd, fd, &offset, size - copied);
+			if (n > 0)
+				src = offset;
+		} else {
+			buffer.resize(COPY_BUFFER_SIZE);
+			int chunk = size - copied < COPY_BUFFER_SIZE ? size - copied : COPY_BUFFER_SIZE;
+			n = mini_fat_file_pread(fs, fd, &buffer[0], chunk, src);
+			if (n > 0 && write(host_fd, &buffer[0], n) != n)
+				n = -1;
+			if (n > 0)
+				src += n;
+		}
+
+		if (n < 0 && method < 2 && copied == 0 && is_copy_unsupported(errno)) {
+			method++;
+			continue;
+		}
+		if (n <= 0) {
+			if (n < 0)
+				perror("Cannot copy to file descriptor");
+			break;
+		}
+		copied += n;
+	}
+	return copied;
+}
+
+/**
+ * Copy a range of the disk (may span consecutive blocks) to a host file
+ * descriptor at its current offset, with copy_file_range, then sendfile
+ * (e.g. for sockets and pipes), then a buffer as fallbacks.
+ * @return copied byte count
+ */
+int mini_fat_copy_to_fd(FAT_FILESYSTEM *fs, const int block_id, const int block_offset, const int size, const int host_fd) {
+	assert(block_id >= 0 && (off_t)block_id * fs->block_size + block_offset + size <= (off_t)fs->block_count * fs->block_size);
+
+	int copied = 0;
+	while (copied < size) {
+		int piece_block = block_id + (block_offset + copied) / fs->block_size;
+		int piece_offset = (block_offset + copied) % fs->block_size;
+		int chunk = mini_fat_contiguous_span(fs, piece_offset, size - copied);
+
+		off_t position;
+		int fd = mini_fat_locate_block(fs, piece_block, piece_offset, &position);
+		int replica = fs->replicas.empty() ? -1 : mini_fat_pick_replica(fs);
+		if (replica == -1 && !fs->replicas.empty())
+			break;
+		int n = mini_fat_kernel_copy_to_fd(fs, replica == -1 ? fd : fs->replicas[replica].fd, position, chunk, host_fd);
+		if (replica != -1)
+			mini_fat_release_replica(fs, replica);
+		copied += n;
+		if (n < chunk)
+			break;
+	}
+	return copied;
+}
+
+// Copy from a host descriptor to a disk file, see mini_fat_copy_from_fd.
+static int mini_fat_kernel_copy_from_fd(FAT_FILESYSTEM *fs, const int host_fd, const int fd, loff_t dst, const int size) {
+	int copied = 0;
+	bool use_buffer = fs->direct_io;
+	std::vector<char> buffer;
+	while (copied < size) {
+		ssize_t n;
+		if (!use_buffer) {
+			n = copy_file_range(host_fd, NULL, fd, &dst, size - copied, 0);
+		} else {
+			buffer.resize(COPY_BUFFER_SIZE);
+			int chunk = size - copied < COPY_BUFFER_SIZE ? size - copied : COPY_BUFFER_SIZE;
+			n = read(host_fd, &buffer[0], chunk);
+			if (n > 0 && mini_fat_file_pwrite(fs, fd, &buffer[0], n, dst) != n)
+				n = -1;
+			if (n > 0)
+				dst += n;
+		}
+
+		if (n < 0 && !use_buffer && copied == 0 && is_copy_unsupported(errno)) {
+			use_buffer = true;
+			continue;
+		}
+		if (n <= 0) {
+			if (n < 0)
+				perror("Cannot copy from file descriptor");
+			break;
+		}
+		copied += n;
+	}
+	return copied;
+}
+
+/**
+ * Copy up to size bytes from a host file descriptor (at its current offset)
+ * into a range of the disk (may span consecutive blocks), with
+ * copy_file_range or a buffer as fallback. Stops early at end of input.
+ * @return copied byte count
+ */
+int mini_fat_copy_from_fd(FAT_FILESYSTEM *fs, const int host_fd, const int block_id, const int block_offset, const int size) {
+	assert(block_id >= 0 && (off_t)block_id * fs->block_size + block_offset + size <= (off_t)fs->block_count * fs->block_size);
+
+	int copied = 0;
+	while (copied < size) {
+		int piece_block = block_id + (block_offset + copied) / fs->block_size;
+		int piece_offset = (block_offset + copied) % fs->block_size;
+		int chunk = mini_fat_contiguous_span(fs, piece_offset, size - copied);
+
+		off_t position;
+		int fd = mini_fat_locate_block(fs, piece_block, piece_offset, &position);
+		// Host data can be read only once: it goes to one replica, then to the others.
+		int replica = fs->replicas.empty() ? -1 : mini_fat_first_replica(fs);
+		if (replica == -1 && !fs->replicas.empty())
+			break;
+		int n = mini_fat_kernel_copy_from_fd(fs, host_fd, replica == -1 ? fd : fs->replicas[replica].fd, position, chunk);
+		if (replica != -1 && n > 0)
+			mini_fat_mirror_range(fs, replica, position, n);
+		copied += n;
+		if (n < chunk)
+			break;
+	}
+	return copied;
+}
 
 /**
  * Find the first empty block in filesystem.
  * @return -1 on failure, index of block on success
  */
 int mini_fat_find_empty_block(const FAT_FILESYSTEM *fat) {
-	// TODO: find an empty block in fat and return its index.
-
+	for (int i=0; i<fat->block_count; ++i) {
+		if (fat->block_map[i] == EMPTY_BLOCK)
+			return i;
+	}
 	return -1;
 }
 
 /**
- * Find the first empty block in filesystem, and allocate it to a type,
+ * Allocation group holding a block.
+ */
+int mini_fat_block_group(const FAT_FILESYSTEM *fs, const int block_id) {
+	return block_id / fs->group_blocks;
+}
+
+/**
+ * Allocation group of the calling thread. Threads get groups round-robin the
+ * first time they ask, so files created by different threads are placed in
+ * different groups.
+ */
+int mini_fat_thread_group(const FAT_FILESYSTEM *fs) {
+	static int next_group = 0;
+	static __thread int thread_group = -1;
+	if (thread_group == -1)
+		thread_group = __sync_fetch_and_add(&next_group, 1);
+	return thread_group % fs->groups.size();
+}
+
+/**
+ * Split the disk in group_count allocation groups of consecutive blocks.
+ * Nothing may allocate while the groups are rebuilt.
+ */
+static void mini_fat_build_groups(FAT_FILESYSTEM *fs, const int group_count) {
+	for (int i=0; i<(int)fs->groups.size(); ++i) {
+		pthread_mutex_destroy(&fs->groups[i].lock);
+	}
+	fs->groups.clear();
+	fs->group_blocks = (fs->block_count + group_count - 1) / group_count;
+	fs->groups.resize((fs->block_count + fs->group_blocks - 1) / fs->group_blocks);
+	for (int i=0; i<(int)fs->groups.size(); ++i) {
+		FAT_GROUP * group = &fs->groups[i];
+		group->first_block = i * fs->group_blocks;
+		group->end_block = std::min(group->first_block + fs->group_blocks, fs->block_count);
+		group->next_free = group->first_block;
+		while (group->next_free < group->end_block && fs->block_map[group->next_free] != EMPTY_BLOCK)
+			group->next_free++;
+		pthread_mutex_init(&group->lock, NULL);
+	}
+}
+
+/**
+ * Take up to count free blocks of a group, under its lock: the run starting
+ * at hint if it is free, else the first free run of count blocks, else the
+ * first free blocks.
+ * @return number of blocks taken, appended to block_ids.
+ */
+static int mini_fat_group_take(FAT_FILESYSTEM *fs, FAT_GROUP *group, const int count, const unsigned char block_type, const int hint, std::vector<int> &block_ids) {
+	pthread_mutex_lock(&group->lock);
+	int start = -1;
+	if (hint >= group->next_free && hint + count <= group->end_block) {
+		start = hint;
+		for (int i=hint; i<hint+count; ++i) {
+			if (fs->block_map[i] != EMPTY_BLOCK) {
+				start = -1;
+				break;
+			}
+		}
+	}
+	for (int i=group->next_free, run=0; start == -1 && i<group->end_block; ++i) {
+		run = fs->block_map[i] == EMPTY_BLOCK ? run + 1 : 0;
+		if (run == count)
+			start = i - count + 1;
+	}
+
+	int taken = 0;
+	for (int i=start; start != -1 && i<start+count; ++i, ++taken) {
+		fs->block_map[i] = block_type;
+		block_ids.push_back(i);
+	}
+	for (int i=group->next_free; start == -1 && i<group->end_block && taken<count; ++i) {
+		if (fs->block_map[i] == EMPTY_BLOCK) {
+			fs->block_map[i] = block_type;
+			block_ids.push_back(i);
+			taken++;
+		}
+	}
+	// Blocks below next_free are all in use.
+	while (group->next_free < group->end_block && fs->block_map[group->next_free] != EMPTY_BLOCK)
+		group->next_free++;
+	pthread_mutex_unlock(&group->lock);
+	return taken;
+}
+
+// Set the type of sorted blocks, locking each group once. In log-structured
+// mode the log allocates under log_lock alone, so that lock is taken too.
+static void mini_fat_mark_blocks(FAT_FILESYSTEM *fs, const std::vector<int> &block_ids, const unsigned char block_type) {
+	if (fs->log_structured)
+		pthread_mutex_lock(&fs->log_lock);
+	for (int i=0; i<(int)block_ids.size(); ) {
+		FAT_GROUP * group = &fs->groups[mini_fat_block_group(fs, block_ids[i])];
+		pthread_mutex_lock(&group->lock);
+		for (; i<(int)block_ids.size() && block_ids[i] < group->end_block; ++i) {
+			fs->block_map[block_ids[i]] = block_type;
+			if (block_type == EMPTY_BLOCK && block_ids[i] < group->next_free)
+				group->next_free = block_ids[i];
+		}
+		pthread_mutex_unlock(&group->lock);
+	}
+	if (fs->log_structured)
+		pthread_mutex_unlock(&fs->log_lock);
+}
+
+/**
+ * Allocate count blocks of a type, see mini_fat_allocate_blocks.
+ * @return false if fewer than count blocks are free (nothing is allocated)
+ */
+static bool mini_fat_allocate_internal(FAT_FILESYSTEM *fs, const int count, const unsigned char block_type, const int hint, std::vector<int> &block_ids) {
+	std::vector<int> new_blocks;
+	if (fs->log_structured) {
+		// Take the blocks in order at the log head, ignoring the hint and groups.
+		pthread_mutex_lock(&fs->log_lock);
+		for (int i=0; i<count; ++i) {
+			int block_id = mini_fat_log_next_block(fs, -1);
+			if (block_id == -1)
+				break;
+			fs->block_map[block_id] = block_type;
+			new_blocks.push_back(block_id);
+		}
+		pthread_mutex_unlock(&fs->log_lock);
+	} else {
+		// Keep the blocks in the group of the hint (or of the calling thread),
+		// spilling over to the following groups only when it is full.
+		int home = hint >= 0 && hint < fs->block_count ? mini_fat_block_group(fs, hint) : mini_fat_thread_group(fs);
+		int group_count = fs->groups.size();
+		for (int i=0; i<group_count && (int)new_blocks.size()<count; ++i) {
+			FAT_GROUP * group = &fs->groups[(home + i) % group_count];
+			mini_fat_group_take(fs, group, count - new_blocks.size(), block_type, i == 0 ? hint : -1, new_blocks);
+		}
+	}
+
+	if ((int)new_blocks.size() < count) {
+		std::sort(new_blocks.begin(), new_blocks.end());
+		mini_fat_mark_blocks(fs, new_blocks, EMPTY_BLOCK);
+		return false;
+	}
+	block_ids.insert(block_ids.end(), new_blocks.begin(), new_blocks.end());
+	return true;
+}
+
+/**
+ * Find an empty block, and allocate it to a type,
  * i.e., set block_map[new_block_index] to the specified type.
+ * @param  hint preferred block (e.g. right after a file's last block), or -1
+ *              for the group of the calling thread
  * @return -1 on failure, new_block_index on success
  */
-int mini_fat_allocate_new_block(FAT_FILESYSTEM *fs, const unsigned char block_type) {
-	int new_block_index = mini_fat_find_empty_block(fs);
-	if (new_block_index == -1)
+int mini_fat_allocate_new_block(FAT_FILESYSTEM *fs, const unsigned char block_type, const int hint) {
+	std::vector<int> block_ids;
+	if (!mini_fat_allocate_internal(fs, 1, block_type, hint, block_ids))
 	{
 		fprintf(stderr, "Cannot allocate block: filesystem is full.\n");
 		return -1;
 	}
-	fs->block_map[new_block_index] = block_type;
-	return new_block_index;
+	return block_ids[0];
+}
+
+// Punch sorted blocks out of the disk files, see mini_fat_free_blocks.
+static void mini_fat_discard_blocks(FAT_FILESYSTEM *fs, const std::vector<int> &block_ids) {
+	int stripes = fs->stripe_fds.size();
+	for (int i=0; i<(int)block_ids.size(); ) {
+		int run = 1;
+		while (i + run < (int)block_ids.size() && block_ids[i+run] == block_ids[i] + run)
+			run++;
+		// The blocks of a run that share a stripe are consecutive in its disk file.
+		for (int j=0; j<stripes && j<run; ++j) {
+			off_t position;
+			std::vector<int> fds = mini_fat_replica_fds(fs, mini_fat_locate_block(fs, block_ids[i] + j, 0, &position));
+			off_t length = (off_t)((run - j + stripes - 1) / stripes) * fs->block_size;
+			for (int k=0; k<(int)fds.size(); ++k) {
+				if (fallocate(fds[k], FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, position, length) != 0) {
+					perror("Cannot discard blocks, disabling discard");
+					fs->discard = false;
+					return;
+				}
+			}
+		}
+		i += run;
+	}
+}
+
+/**
+ * Mark blocks as empty. With fs->discard set, the freed blocks are also
+ * released on the host: consecutive blocks are merged into ranges and each
+ * range is punched out of the disk file with a single fallocate call,
+ * before the blocks can be allocated again. Blocks held by a snapshot are
+ * not freed but handed over to it, as SNAPSHOT_DATA_BLOCK.
+ */
+void mini_fat_free_blocks(FAT_FILESYSTEM *fs, std::vector<int> block_ids) {
+	std::sort(block_ids.begin(), block_ids.end());
+	std::vector<int> kept;
+	for (int i=0; !fs->snapshots.empty() && i<(int)block_ids.size(); ++i) {
+		if (fs->snapshot_blocks[block_ids[i]])
+			kept.push_back(block_ids[i]);
+	}
+	if (!kept.empty()) {
+		std::vector<int> freed;
+		std::set_difference(block_ids.begin(), block_ids.end(), kept.begin(), kept.end(), std::back_inserter(freed));
+		block_ids.swap(freed);
+		mini_fat_mark_blocks(fs, kept, SNAPSHOT_DATA_BLOCK);
+	}
+	if (fs->discard)
+		mini_fat_discard_blocks(fs, block_ids);
+	mini_fat_mark_blocks(fs, block_ids, EMPTY_BLOCK);
+}
+
+/**
+ * Allocate count blocks of a type at once, preferring a single contiguous
+ * run: first the run starting at hint (e.g. right after a file's last block),
+ * then the first run that is long enough. If no run fits, the first free
+ * blocks are taken. Blocks come from the allocation group of the hint (or of
+ * the calling thread without hint) while it has room.
+ * @param  hint      preferred first block, or -1
+ * @param  block_ids receives the new block indexes in order
+ * @return false if fewer than count blocks are free (nothing is allocated)
+ */
+bool mini_fat_allocate_blocks(FAT_FILESYSTEM *fs, const int count, const unsigned char block_type, const int hint, std::vector<int> &block_ids) {
+	if (!mini_fat_allocate_internal(fs, count, block_type, hint, block_ids)) {
+		fprintf(stderr, "Cannot allocate %d blocks: filesystem is full.\n", count);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Split the disk in group_count allocation groups of consecutive blocks, each
+ * with its own lock and free index, so threads writing different files do
+ * not wait for each other to allocate. New files go to the group of the
+ * creating thread and their blocks stay in the group of their entry block.
+ * The groups are not stored on disk.
+ */
+bool mini_fat_set_allocation_groups(FAT_FILESYSTEM *fs, const int group_count) {
+	if (group_count <= 0 || group_count > fs->block_count) {
+		fprintf(stderr, "Cannot split fat in %d allocation groups.\n", group_count);
+		return false;
+	}
+	FAT_LOCK lock(fs, true);
+	mini_fat_build_groups(fs, group_count);
+	return true;
 }
 
 void mini_fat_dump(const FAT_FILESYSTEM *fat) {
@@ -84,9 +953,30 @@ void mini_fat_dump(const FAT_FILESYSTEM *fat) {
 	}
 	printf("\n");
 
-	for (int i=0; i<fat->files.size(); ++i) {
+	for (int i=0; i<(int)fat->files.size(); ++i) {
 		mini_file_dump(fat, fat->files[i]);
 	}
+	for (int i=0; i<(int)fat->snapshots.size(); ++i) {
+		const FAT_SNAPSHOT &snapshot = fat->snapshots[i];
+		printf("Snapshot: %s\tCreated: %lld\tHeader block: %d\tFiles: %d\tBlocks: %d\n", snapshot.name, snapshot.created,
+			snapshot.header_block_ids[0], (int)snapshot.entry_block_ids.size(), (int)snapshot.block_ids.size());
+	}
+	for (int i=0; i<(int)fat->replicas.size(); ++i) {
+		const FAT_REPLICA &replica = fat->replicas[i];
+		int missed = std::count(replica.missed_blocks.begin(), replica.missed_blocks.end(), true);
+		printf("Replica: %s\t%s", replica.filename, replica.is_stale ? "Stale" : "In sync");
+		if (replica.is_stale)
+			printf(" (%d blocks to resync)", missed);
+		printf("\n");
+	}
+}
+
+/**
+ * Number of blocks at the start of the disk holding the filesystem header and
+ * block_map. This is a single block unless block_map is larger than a block.
+ */
+int mini_fat_metadata_block_count(const int block_size, const int block_count) {
+	return (FAT_HEADER_SIZE + block_count + block_size - 1) / block_size;
 }
 
 static FAT_FILESYSTEM * mini_fat_create_internal(const char * filename, const int block_size, const int block_count) {
@@ -95,7 +985,112 @@ static FAT_FILESYSTEM * mini_fat_create_internal(const char * filename, const in
 	fat->block_size = block_size;
 	fat->block_count = block_count;
 	fat->block_map.resize(fat->block_count, EMPTY_BLOCK); // Set all blocks to empty.
-	fat->block_map[0] = METADATA_BLOCK;
+	int metadata_blocks = mini_fat_metadata_block_count(block_size, block_count);
+	for (int i=0; i<metadata_blocks && i<block_count; ++i) {
+		fat->block_map[i] = METADATA_BLOCK;
+	}
+	fat->fd = -1;
+	fat->stripe_filenames.push_back(filename);
+	fat->map = NULL;
+	fat->generation = 0;
+	fat->discard = false;
+	fat->log_structured = false;
+	fat->segment_blocks = 0;
+	fat->log_head = -1;
+	fat->is_cleaner_running = false;
+	fat->direct_io = false;
+	fat->snapshot_blocks.resize(block_count, false);
+	fat->mounted_snapshot = NULL;
+
+	pthread_rwlock_init(&fat->lock, NULL);
+	pthread_mutex_init(&fat->files_lock, NULL);
+	pthread_mutex_init(&fat->log_lock, NULL);
+	pthread_mutex_init(&fat->cleaner_lock, NULL);
+	pthread_mutex_init(&fat->buffer_lock, NULL);
+	for (int i=0; i<FAT_DIRECT_LOCK_COUNT; ++i) {
+		pthread_mutex_init(&fat->direct_locks[i], NULL);
+	}
+	pthread_mutex_init(&fat->replica_lock, NULL);
+	pthread_cond_init(&fat->cleaner_wakeup, NULL);
+	mini_fat_build_groups(fat, 1);
+	return fat;
+}
+
+// Whether a view from mini_file_map still points into the disk mapping.
+static bool mini_fat_has_mapped_views(const FAT_FILESYSTEM *fs) {
+	for (int i=0; i<(int)fs->files.size(); ++i) {
+		if (fs->files[i]->mapped_views > 0)
+			return true;
+	}
+	return false;
+}
+
+/**
+ * Map the whole disk read-only, so file data can be accessed in place.
+ * The mapping is shared, hence it always reflects the latest block writes.
+ * Failing to map is not fatal: mini_file_map falls back to copies.
+ */
+static void mini_fat_map_disk(FAT_FILESYSTEM *fs) {
+	if (fs->stripe_fds.size() > 1 || fs->replicas.size() > 1 || fs->direct_io)
+		return; // Blocks are spread over several files, copies may differ while one is stale, or bypass the page cache.
+	void * map = mmap(NULL, (size_t)fs->block_size * fs->block_count, PROT_READ, MAP_SHARED, fs->fd, 0);
+	if (map == MAP_FAILED) {
+		perror("Cannot map fat file");
+		return;
+	}
+	fs->map = (const unsigned char *)map;
+}
+
+/**
+ * Set the size of every disk file for a disk of block_count blocks.
+ */
+static bool mini_fat_size_stripes(FAT_FILESYSTEM *fs, const int block_count) {
+	int stripes = fs->stripe_fds.size();
+	for (int i=0; i<stripes; ++i) {
+		int stripe_blocks = block_count > i ? (block_count - i + stripes - 1) / stripes : 0;
+		off_t size = (off_t)fs->block_size * stripe_blocks;
+		if (fs->direct_io)
+			size = mini_fat_align_up(size); // Whole sectors, so edge writes do not grow the file.
+		std::vector<int> fds = mini_fat_replica_fds(fs, fs->stripe_fds[i]);
+		for (int j=0; j<(int)fds.size(); ++j) {
+			if (ftruncate(fds[j], size) != 0) {
+				perror("Cannot resize fat file");
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+/**
+ * Create a new virtual disk striped over several disk files, ideally on
+ * different devices. Blocks are spread round-robin over the files, so large
+ * transfers use all of them at once. Block 0 of the first file holds the
+ * metadata. Overwrites existing files.
+ * @return FAT_FILESYSTEM pointer, or NULL on failure.
+ */
+FAT_FILESYSTEM * mini_fat_create_striped(const std::vector<const char *> &filenames, const int block_size, const int block_count) {
+	assert(block_size > 0 && block_count > 0 && !filenames.empty());
+	FAT_FILESYSTEM * fat = mini_fat_create_internal(filenames[0], block_size, block_count);
+	fat->stripe_filenames = filenames;
+
+	for (int i=0; i<(int)filenames.size(); ++i) {
+		int fd = open(filenames[i], O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0) {
+			perror("Cannot create fat file");
+			mini_fat_close(fat);
+			return NULL;
+		}
+		fat->stripe_fds.push_back(fd);
+	}
+	fat->fd = fat->stripe_fds[0];
+	if (!mini_fat_size_stripes(fat, block_count)) {
+		mini_fat_close(fat);
+		return NULL;
+	}
+	mini_fat_map_disk(fat);
+	// Write the empty metadata, so the new disk can be loaded right away.
+	mini_fat_save(fat);
 	return fat;
 }
 
@@ -109,11 +1104,97 @@ static FAT_FILESYSTEM * mini_fat_create_internal(const char * filename, const in
  * @return             FAT_FILESYSTEM pointer with parameters set.
  */
 FAT_FILESYSTEM * mini_fat_create(const char * filename, const int block_size, const int block_count) {
+	std::vector<const char *> filenames(1, filename);
+	return mini_fat_create_striped(filenames, block_size, block_count);
+}
 
-	FAT_FILESYSTEM * fat = mini_fat_create_internal(filename, block_size, block_count);
+// Give blocks taken for a checkpoint back to the log, after a failed write.
+static void mini_fat_log_keep_pending(FAT_FILESYSTEM *fs, const std::vector<int> &block_ids) {
+	pthread_mutex_lock(&fs->log_lock);
+	fs->log_pending_free.insert(fs->log_pending_free.end(), block_ids.begin(), block_ids.end());
+	pthread_mutex_unlock(&fs->log_lock);
+}
 
-	// TODO: create the corresponding virtual disk file with appropriate size.
-	return fat;
+/**
+ * Write the block map and the entries of files to disk with a single
+ * mini_fat_transfer_blocks call, so consecutive entry blocks go out in one
+ * write. The caller holds the disk lock exclusively.
+ * @param  is_checkpoint files are all the files of the disk: the old copies
+ *         of blocks the log moved are written as free, and freed once the
+ *         write succeeded (see log_pending_free).
+ * @return true on success
+ */
+bool mini_fat_write_metadata(FAT_FILESYSTEM *fs, const std::vector<FAT_FILE *> &files, const bool is_checkpoint) {
+	if (fs->fd < 0) {
+		fprintf(stderr, "Cannot save fat to file: disk is not open.\n");
+		return false;
+	}
+	// Entries shared with a snapshot get their own copy, and entries are
+	// appended to the log too; move them before the block map is written.
+	std::vector<int*> entry_blocks;
+	std::vector<int> old_entry_blocks;
+	std::vector<bool> keep_contents;
+	for (int i=0; i<(int)files.size(); ++i) {
+		entry_blocks.push_back(&files[i]->metadata_block_id);
+		old_entry_blocks.push_back(files[i]->metadata_block_id);
+		keep_contents.push_back(files[i]->block_ids.empty() && files[i]->size > 0);
+	}
+	if (!mini_fat_snapshot_unshare(fs, entry_blocks, keep_contents)) {
+		fprintf(stderr, "Cannot save fat to file: no room to copy entries shared with a snapshot.\n");
+		return false;
+	}
+	for (int i=0; fs->log_structured && i<(int)files.size(); ++i) {
+		if (files[i]->metadata_block_id == old_entry_blocks[i])
+			files[i]->metadata_block_id = mini_fat_log_relocate(fs, files[i]->metadata_block_id, keep_contents[i]);
+	}
+	// Taken after the entries moved, so their old copies are released too.
+	std::vector<int> released;
+	if (is_checkpoint) {
+		pthread_mutex_lock(&fs->log_lock);
+		released.swap(fs->log_pending_free);
+		pthread_mutex_unlock(&fs->log_lock);
+	}
+
+	int metadata_blocks = mini_fat_metadata_block_count(fs->block_size, fs->block_count);
+	std::vector<char> metadata(metadata_blocks * fs->block_size, 0);
+	fs->generation++;
+	unsigned int header[5] = {FAT_MAGIC, (unsigned int)fs->block_size, (unsigned int)fs->block_count, (unsigned int)fs->stripe_fds.size(), fs->generation};
+	memcpy(&metadata[0], header, FAT_HEADER_SIZE);
+	memcpy(&metadata[FAT_HEADER_SIZE], &fs->block_map[0], fs->block_count);
+	for (int i=0; i<(int)released.size(); ++i) {
+		metadata[FAT_HEADER_SIZE + released[i]] = fs->snapshot_blocks[released[i]] ? SNAPSHOT_DATA_BLOCK : EMPTY_BLOCK;
+	}
+	std::vector<FAT_BLOCK_IO> ios;
+	for (int i=0; i<metadata_blocks; ++i) {
+		FAT_BLOCK_IO io = {i, 0, fs->block_size, &metadata[i * fs->block_size], 0};
+		ios.push_back(io);
+	}
+
+	// Whole blocks, so that entries in consecutive blocks merge, except where
+	// inline data follows the entry.
+	std::vector<char> entries(files.size() * fs->block_size, 0);
+	for (int i=0; i<(int)files.size(); ++i) {
+		int entry_size = mini_file_encode_entry(fs, files[i], &entries[i * fs->block_size]);
+		if (entry_size < 0) {
+			mini_fat_log_keep_pending(fs, released);
+			return false;
+		}
+		bool is_inline = files[i]->block_ids.empty() && files[i]->size > 0;
+		FAT_BLOCK_IO io = {files[i]->metadata_block_id, 0, is_inline ? entry_size : fs->block_size, &entries[i * fs->block_size], 0};
+		ios.push_back(io);
+	}
+
+	int size = 0;
+	for (int i=0; i<(int)ios.size(); ++i) {
+		size += ios[i].size;
+	}
+	if (mini_fat_transfer_blocks(fs, ios, true) != size) {
+		fprintf(stderr, "Cannot save fat to file: metadata write failed.\n");
+		mini_fat_log_keep_pending(fs, released);
+		return false;
+	}
+	mini_fat_free_blocks(fs, released);
+	return true;
 }
 
 /**
@@ -126,26 +1207,478 @@ FAT_FILESYSTEM * mini_fat_create(const char * filename, const int block_size, co
  * @return     true on success
  */
 bool mini_fat_save(const FAT_FILESYSTEM *fat) {
-	FILE * fat_fd = fopen(fat->filename, "r+");
-	if (fat_fd == NULL) {
-		perror("Cannot save fat to file");
+	FAT_FILESYSTEM * fs = const_cast<FAT_FILESYSTEM *>(fat);
+	FAT_LOCK lock(fs, true);
+	if (mini_fat_is_read_only(fs))
 		return false;
-	}
-	// TODO: save all metadata (filesystem metadata, file metadata).
-
-	return true;
+	return mini_fat_write_metadata(fs, fs->files, true);
 }
 
+/**
+ * Load a virtual disk. "disk@name" mounts snapshot name of disk instead,
+ * read-only, unless a disk file has that very name.
+ */
 FAT_FILESYSTEM * mini_fat_load(const char *filename) {
-	FILE * fat_fd = fopen(filename, "r+");
-	if (fat_fd == NULL) {
-		perror("Cannot load fat from file");
+	const char * at = strrchr(filename, '@');
+	if (at && access(filename, F_OK) != 0) {
+		std::string base_filename(filename, at - filename);
+		std::vector<const char *> filenames(1, base_filename.c_str());
+		FAT_FILESYSTEM * fat = mini_fat_load_snapshot(filenames, at + 1);
+		if (fat) {
+			fat->base_filename = base_filename;
+			fat->filename = filename;
+			fat->stripe_filenames[0] = fat->base_filename.c_str();
+		}
+		return fat;
+	}
+	std::vector<const char *> filenames(1, filename);
+	return mini_fat_load_striped(filenames);
+}
+
+static FAT_FILESYSTEM * mini_fat_load_internal(const std::vector<const char *> &filenames, const bool is_read_only) {
+	std::vector<int> fds;
+	for (int i=0; i<(int)filenames.size(); ++i) {
+		int fd = open(filenames[i], is_read_only ? O_RDONLY : O_RDWR);
+		if (fd < 0) {
+			perror("Cannot load fat from file");
+			exit(-1);
+		}
+		fds.push_back(fd);
+	}
+
+	unsigned int header[5];
+	if (pread(fds[0], header, FAT_HEADER_SIZE, 0) != FAT_HEADER_SIZE || header[0] != FAT_MAGIC) {
+		fprintf(stderr, "Cannot load fat from file: '%s' is not a fat disk.\n", filenames[0]);
+		exit(-1);
+	}
+	if (header[3] != filenames.size()) {
+		fprintf(stderr, "Cannot load fat from file: '%s' is striped over %u files, %d given.\n",
+			filenames[0], header[3], (int)filenames.size());
 		exit(-1);
 	}
-	// TODO: load all metadata (filesystem metadata, file metadata) and create filesystem.
 
-	int block_size = 1024, block_count = 10;
-	FAT_FILESYSTEM * fat = mini_fat_create_internal(filename, block_size, block_count);
+	int block_size = header[1], block_count = header[2];
+	FAT_FILESYSTEM * fat = mini_fat_create_internal(filenames[0], block_size, block_count);
+	fat->stripe_filenames = filenames;
+	fat->stripe_fds = fds;
+	fat->fd = fds[0];
+	fat->generation = header[4];
+
+	int metadata_blocks = mini_fat_metadata_block_count(block_size, block_count);
+	std::vector<unsigned char> metadata(metadata_blocks * block_size, 0);
+	for (int i=0; i<metadata_blocks; ++i) {
+		mini_fat_read_in_block(fat, i, 0, block_size, &metadata[i * block_size]);
+	}
+	memcpy(&fat->block_map[0], &metadata[FAT_HEADER_SIZE], block_count);
+	mini_fat_build_groups(fat, 1);
 
+	for (int i=0; i<block_count; ++i) {
+		if (fat->block_map[i] != FILE_ENTRY_BLOCK)
+			continue;
+		FAT_FILE * file = mini_file_load_entry(fat, i);
+		if (file)
+			fat->files.push_back(file);
+	}
+	mini_fat_load_snapshots(fat);
 	return fat;
 }
+
+/**
+ * Load a virtual disk striped over several disk files, which must be given
+ * in the order they were passed to mini_fat_create_striped.
+ */
+FAT_FILESYSTEM * mini_fat_load_striped(const std::vector<const char *> &filenames) {
+	FAT_FILESYSTEM * fat = mini_fat_load_internal(filenames, false);
+	mini_fat_map_disk(fat);
+	return fat;
+}
+
+/**
+ * Mount a snapshot of a (possibly striped) virtual disk: the disk files are
+ * opened read-only and the files are the ones of the snapshot. Every call
+ * that would change the disk fails.
+ * @return NULL if the disk has no snapshot of that name.
+ */
+FAT_FILESYSTEM * mini_fat_load_snapshot(const std::vector<const char *> &filenames, const char * name) {
+	FAT_FILESYSTEM * fat = mini_fat_load_internal(filenames, true);
+	if (!mini_fat_mount_snapshot(fat, name)) {
+		mini_fat_close(fat);
+		return NULL;
+	}
+	mini_fat_map_disk(fat);
+	return fat;
+}
+
+/**
+ * Create a new virtual disk mirrored over several disk files (RAID-1),
+ * ideally on different devices. Every disk file holds a full copy of the
+ * disk, which mini_fat_load can also open on its own. Writes go to all
+ * copies; each read goes to the copy with the fewest reads in progress, and
+ * large reads are split over all of them. A disk is either mirrored or
+ * striped, not both. Overwrites existing files.
+ * @return FAT_FILESYSTEM pointer, or NULL on failure.
+ */
+FAT_FILESYSTEM * mini_fat_create_mirrored(const std::vector<const char *> &filenames, const int block_size, const int block_count) {
+	assert(block_size > 0 && block_count > 0 && !filenames.empty());
+	FAT_FILESYSTEM * fat = mini_fat_create_internal(filenames[0], block_size, block_count);
+	for (int i=0; i<(int)filenames.size(); ++i) {
+		int fd = open(filenames[i], O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0) {
+			perror("Cannot create fat file");
+			mini_fat_close(fat);
+			return NULL;
+		}
+		FAT_REPLICA replica = {filenames[i], fd, 0, false, std::vector<bool>()};
+		fat->replicas.push_back(replica);
+		if (i == 0) {
+			fat->stripe_fds.push_back(fd);
+			fat->fd = fd;
+		}
+	}
+	if (!mini_fat_size_stripes(fat, block_count)) {
+		mini_fat_close(fat);
+		return NULL;
+	}
+	mini_fat_save(fat);
+	return fat;
+}
+
+/**
+ * Load a mirrored virtual disk. The disk file with the newest metadata is
+ * loaded; the others (including missing files, created empty) are stale
+ * until mini_fat_resync copies the whole disk to them. Like a new mirrored
+ * disk, it is never mapped, since the copies may differ.
+ */
+FAT_FILESYSTEM * mini_fat_load_mirrored(const std::vector<const char *> &filenames) {
+	std::vector<int> fds;
+	std::vector<unsigned int> generations;
+	int newest = -1;
+	for (int i=0; i<(int)filenames.size(); ++i) {
+		int fd = open(filenames[i], O_RDWR | O_CREAT, 0644);
+		if (fd < 0) {
+			perror("Cannot load fat from file");
+			exit(-1);
+		}
+		unsigned int header[5];
+		bool is_valid = pread(fd, header, FAT_HEADER_SIZE, 0) == FAT_HEADER_SIZE && header[0] == FAT_MAGIC && header[3] == 1;
+		fds.push_back(fd);
+		generations.push_back(is_valid ? header[4] : 0);
+		if (is_valid && (newest == -1 || header[4] > generations[newest]))
+			newest = i;
+	}
+	if (newest == -1) {
+		fprintf(stderr, "Cannot load fat from file: no copy of '%s' is a fat disk.\n", filenames[0]);
+		exit(-1);
+	}
+
+	FAT_FILESYSTEM * fat = mini_fat_load_internal(std::vector<const char *>(1, filenames[newest]), false);
+	close(fds[newest]);
+	fds[newest] = fat->fd;
+	for (int i=0; i<(int)filenames.size(); ++i) {
+		FAT_REPLICA replica = {filenames[i], fds[i], 0, false, std::vector<bool>()};
+		fat->replicas.push_back(replica);
+	}
+	for (int i=0; i<(int)filenames.size(); ++i) {
+		if (generations[i] != generations[newest])
+			mini_fat_miss_blocks(fat, i, 0, -1);
+	}
+	return fat;
+}
+
+/**
+ * Bring the stale replicas of a mirrored disk up to date: copy the blocks
+ * they missed from an in-sync replica, skipping free blocks, and read and
+ * write them again. Replicas that fail again stay stale.
+ * @return number of replicas still stale, or -1 if no replica is in sync.
+ */
+int mini_fat_resync(FAT_FILESYSTEM *fs) {
+	FAT_LOCK lock(fs, true);
+	int source = mini_fat_first_replica(fs);
+	if (source == -1) {
+		if (!fs->replicas.empty())
+			fprintf(stderr, "Cannot resync '%s': no replica is in sync.\n", fs->filename);
+		return fs->replicas.empty() ? 0 : -1;
+	}
+	mini_fat_size_stripes(fs, fs->block_count); // New replicas are empty files.
+
+	int stale = 0;
+	bool is_recovered = false;
+	for (int i=0; i<(int)fs->replicas.size(); ++i) {
+		FAT_REPLICA * replica = &fs->replicas[i];
+		if (!replica->is_stale)
+			continue;
+		std::vector<bool> &missed = replica->missed_blocks;
+		bool is_done = true;
+		for (int block=0; is_done && block<(int)missed.size() && block<fs->block_count; ) {
+			int run = 0;
+			while (block + run < (int)missed.size() && block + run < fs->block_count && missed[block+run] && fs->block_map[block+run] != EMPTY_BLOCK)
+				run++;
+			if (run == 0) {
+				block++;
+				continue;
+			}
+			off_t position = (off_t)block * fs->block_size;
+			int size = run * fs->block_size;
+			is_done = mini_fat_file_copy(fs, fs->replicas[source].fd, position, replica->fd, position, size) == size;
+			block += run;
+		}
+		if (!is_done) {
+			fprintf(stderr, "Cannot resync replica '%s'.\n", replica->filename);
+			stale++;
+			continue;
+		}
+		pthread_mutex_lock(&fs->replica_lock);
+		replica->is_stale = false;
+		replica->missed_blocks.clear();
+		pthread_mutex_unlock(&fs->replica_lock);
+		is_recovered = true;
+	}
+	// Give every in-sync replica the same, new generation.
+	if (is_recovered)
+		mini_fat_write_metadata(fs, std::vector<FAT_FILE *>());
+	return stale;
+}
+
+/**
+ * Move every live block whose must_move entry is set to a free block in
+ * [first, last), updating the files that use it. Used to clear the space
+ * that a resize takes away or turns into metadata. Files may be open.
+ * @return false if there are not enough free blocks or a copy fails
+ *         (nothing is moved).
+ */
+static bool mini_fat_relocate_blocks(FAT_FILESYSTEM *fs, const std::vector<bool> &must_move, const int first, const int last) {
+	// Old copies left by the log hold nothing a file still uses, they are not moved.
+	std::vector<bool> is_pending(fs->block_count, false);
+	for (int i=0; i<(int)fs->log_pending_free.size(); ++i) {
+		is_pending[fs->log_pending_free[i]] = true;
+	}
+	std::vector<int> targets;
+	int needed = 0;
+	for (int i=0; i<fs->block_count; ++i) {
+		bool is_snapshot = fs->block_map[i] == SNAPSHOT_BLOCK || fs->block_map[i] == SNAPSHOT_DATA_BLOCK || fs->snapshot_blocks[i];
+		if (must_move[i] && is_snapshot) {
+			fprintf(stderr, "Cannot relocate block %d: it is held by a snapshot.\n", i);
+			return false;
+		}
+		bool is_live = (fs->block_map[i] == FILE_ENTRY_BLOCK || fs->block_map[i] == FILE_DATA_BLOCK) && !is_pending[i];
+		if (must_move[i] && is_live)
+			needed++;
+		else if (!must_move[i] && fs->block_map[i] == EMPTY_BLOCK && i >= first && i < last)
+			targets.push_back(i);
+	}
+	if ((int)targets.size() < needed) {
+		fprintf(stderr, "Cannot relocate %d blocks: only %d free blocks left.\n", needed, (int)targets.size());
+		return false;
+	}
+
+	// Copy every block before updating anything, so a failed copy leaves the
+	// files and block_map as they were.
+	std::vector<int*> moved; // Block references of the files to update.
+	for (int i=0; i<(int)fs->files.size(); ++i) {
+		FAT_FILE * file = fs->files[i];
+		if (must_move[file->metadata_block_id])
+			moved.push_back(&file->metadata_block_id);
+		for (int j=0; j<(int)file->block_ids.size(); ++j) {
+			if (must_move[file->block_ids[j]])
+				moved.push_back(&file->block_ids[j]);
+		}
+	}
+	for (int i=0; i<(int)moved.size(); ++i) {
+		if (i == (int)targets.size() || mini_fat_copy_range(fs, *moved[i], 0, targets[i], 0, fs->block_size) != fs->block_size) {
+			fprintf(stderr, "Cannot relocate block %d: copy failed.\n", *moved[i]);
+			return false;
+		}
+	}
+	for (int i=0; i<(int)moved.size(); ++i) {
+		int from = *moved[i];
+		fs->block_map[targets[i]] = fs->block_map[from];
+		fs->block_map[from] = EMPTY_BLOCK;
+		*moved[i] = targets[i];
+	}
+	return true;
+}
+
+/**
+ * Grow or shrink the disk to new_block_count blocks, while files may be open.
+ * Growing extends the disk file and block_map; if block_map then needs more
+ * metadata blocks, the blocks in the way are moved first. Shrinking first
+ * moves the live blocks past the new end into free blocks below it, then cuts
+ * the disk file, and frees metadata blocks block_map no longer needs.
+ * The new geometry is saved to the disk.
+ * @return false if live blocks do not fit in the new size, or a view from
+ *         mini_file_map is still mapped (nothing changes).
+ */
+bool mini_fat_resize(FAT_FILESYSTEM *fs, const int new_block_count) {
+	FAT_LOCK lock(fs, true);
+	if (mini_fat_is_read_only(fs))
+		return false;
+	if (mini_fat_has_mapped_views(fs)) {
+		fprintf(stderr, "Cannot resize fat to %d blocks: file views are still mapped.\n", new_block_count);
+		return false;
+	}
+	int old_block_count = fs->block_count;
+	int old_metadata_blocks = mini_fat_metadata_block_count(fs->block_size, old_block_count);
+	int new_metadata_blocks = mini_fat_metadata_block_count(fs->block_size, new_block_count);
+	if (new_block_count <= new_metadata_blocks) {
+		fprintf(stderr, "Cannot resize fat to %d blocks: too small.\n", new_block_count);
+		return false;
+	}
+	if (new_block_count == old_block_count)
+		return true;
+
+	bool is_growing = new_block_count > old_block_count;
+	if (is_growing && !mini_fat_size_stripes(fs, new_block_count))
+		return false;
+	if (is_growing) {
+		fs->block_map.resize(new_block_count, EMPTY_BLOCK);
+		fs->snapshot_blocks.resize(new_block_count, false);
+		fs->block_count = new_block_count;
+	}
+
+	// Blocks that become metadata or fall past the new end have to move.
+	std::vector<bool> must_move(fs->block_count, false);
+	for (int i=old_metadata_blocks; i<new_metadata_blocks; ++i) {
+		must_move[i] = true;
+	}
+	for (int i=new_block_count; i<old_block_count; ++i) {
+		must_move[i] = true;
+	}
+	if (!mini_fat_relocate_blocks(fs, must_move, new_metadata_blocks, new_block_count)) {
+		if (is_growing) {
+			fs->block_map.resize(old_block_count);
+			fs->snapshot_blocks.resize(old_block_count);
+			fs->block_count = old_block_count;
+			mini_fat_size_stripes(fs, old_block_count);
+		}
+		return false;
+	}
+
+	// Pending blocks in the way are overwritten or cut; the save below rewrites every entry.
+	std::vector<int> pending;
+	for (int i=0; i<(int)fs->log_pending_free.size(); ++i) {
+		if (!must_move[fs->log_pending_free[i]])
+			pending.push_back(fs->log_pending_free[i]);
+	}
+	fs->log_pending_free.swap(pending);
+	for (int i=old_metadata_blocks; i<new_metadata_blocks; ++i) {
+		fs->block_map[i] = METADATA_BLOCK;
+	}
+	for (int i=new_metadata_blocks; i<old_metadata_blocks; ++i) {
+		fs->block_map[i] = EMPTY_BLOCK;
+	}
+	if (fs->map)
+		munmap((void *)fs->map, (size_t)fs->block_size * old_block_count);
+	fs->map = NULL;
+	fs->block_map.resize(new_block_count);
+	fs->snapshot_blocks.resize(new_block_count);
+	fs->block_count = new_block_count;
+	mini_fat_build_groups(fs, std::min((int)fs->groups.size(), new_block_count));
+
+	// Save before cutting the disk file, so the metadata never points past its end.
+	bool saved = mini_fat_write_metadata(fs, fs->files, true);
+	if (!is_growing)
+		mini_fat_size_stripes(fs, new_block_count);
+	mini_fat_map_disk(fs);
+	return saved;
+}
+
+/**
+ * Reopen the disk files with (or without) O_DIRECT, so block I/O bypasses
+ * the page cache when the application caches data itself. Unaligned
+ * requests then go through a pool of aligned buffers, and the disk files
+ * are padded to whole sectors. The read-only mapping is dropped, so file
+ * views are copies. The mode is not stored on disk.
+ * @return false if the files cannot be reopened (e.g. O_DIRECT is not
+ *         supported by the host filesystem) or file views are still mapped;
+ *         the disk is left unchanged.
+ */
+bool mini_fat_set_direct_io(FAT_FILESYSTEM *fs, const bool enable) {
+	FAT_LOCK lock(fs, true);
+	if (mini_fat_has_mapped_views(fs)) {
+		fprintf(stderr, "Cannot reopen fat file: file views are still mapped.\n");
+		return false;
+	}
+	std::vector<const char *> filenames = fs->stripe_filenames;
+	if (!fs->replicas.empty())
+		filenames.clear();
+	for (int i=0; i<(int)fs->replicas.size(); ++i) {
+		filenames.push_back(fs->replicas[i].filename);
+	}
+	std::vector<int> fds;
+	for (int i=0; i<(int)filenames.size(); ++i) {
+		int fd = open(filenames[i], (fs->mounted_snapshot ? O_RDONLY : O_RDWR) | (enable ? O_DIRECT : 0));
+		if (fd < 0) {
+			perror("Cannot reopen fat file");
+			for (int j=0; j<(int)fds.size(); ++j) {
+				close(fds[j]);
+			}
+			return false;
+		}
+		fds.push_back(fd);
+	}
+
+	if (fs->map)
+		munmap((void *)fs->map, (size_t)fs->block_size * fs->block_count);
+	fs->map = NULL;
+	std::vector<int> old_fds = fs->replicas.empty() ? fs->stripe_fds : mini_fat_replica_fds(fs, fs->fd);
+	int primary = 0; // The copy the disk was loaded from, which is not always the first replica.
+	for (int i=0; i<(int)fs->replicas.size(); ++i) {
+		if (fs->replicas[i].fd == fs->fd)
+			primary = i;
+		fs->replicas[i].fd = fds[i];
+	}
+	for (int i=0; i<(int)old_fds.size(); ++i) {
+		close(old_fds[i]);
+	}
+	if (!fs->replicas.empty())
+		fds = std::vector<int>(1, fds[primary]);
+	fs->stripe_fds = fds;
+	fs->fd = fds[0];
+	fs->direct_io = enable;
+	if (!fs->mounted_snapshot)
+		mini_fat_size_stripes(fs, fs->block_count);
+	mini_fat_map_disk(fs);
+	return true;
+}
+
+/**
+ * Close the virtual disk file and free the filesystem, its files and any
+ * handles still open. Does not save; call mini_fat_save first if needed.
+ */
+void mini_fat_close(FAT_FILESYSTEM *fs) {
+	if (fs == NULL) return;
+	mini_fat_log_stop_cleaner(fs);
+	for (int i=0; i<(int)fs->files.size(); ++i) {
+		FAT_FILE * file = fs->files[i];
+		for (int j=0; j<(int)file->open_handles.size(); ++j) {
+			delete file->open_handles[j];
+		}
+		delete file;
+	}
+	if (fs->map)
+		munmap((void *)fs->map, (size_t)fs->block_size * fs->block_count);
+	for (int i=0; i<(int)fs->stripe_fds.size(); ++i) {
+		close(fs->stripe_fds[i]);
+	}
+	for (int i=0; i<(int)fs->replicas.size(); ++i) {
+		if (fs->replicas[i].fd != fs->fd)
+			close(fs->replicas[i].fd);
+	}
+	for (int i=0; i<(int)fs->groups.size(); ++i) {
+		pthread_mutex_destroy(&fs->groups[i].lock);
+	}
+	pthread_rwlock_destroy(&fs->lock);
+	pthread_mutex_destroy(&fs->files_lock);
+	pthread_mutex_destroy(&fs->log_lock);
+	pthread_mutex_destroy(&fs->cleaner_lock);
+	pthread_mutex_destroy(&fs->buffer_lock);
+	for (int i=0; i<FAT_DIRECT_LOCK_COUNT; ++i) {
+		pthread_mutex_destroy(&fs->direct_locks[i]);
+	}
+	pthread_mutex_destroy(&fs->replica_lock);
+	for (int i=0; i<(int)fs->direct_buffers.size(); ++i) {
+		free(fs->direct_buffers[i]);
+	}
+	pthread_cond_destroy(&fs->cleaner_wakeup);
+	delete fs;
+}
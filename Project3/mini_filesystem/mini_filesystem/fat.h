@@ -1,14 +1,52 @@
 #ifndef FAT_H
 #define FAT_H
 
+#include <string>
 #include <vector>
+#include <pthread.h>
 
 typedef struct t_FAT_FILE FAT_FILE; // Forward definition.
 
 const unsigned char EMPTY_BLOCK = 0;
 const unsigned char FILE_ENTRY_BLOCK = 1;
 const unsigned char FILE_DATA_BLOCK = 2;
-const unsigned char METADATA_BLOCK = 3; // Only for the first block.
+const unsigned char METADATA_BLOCK = 3; // Block 0, plus the following blocks if block_map does not fit in one.
+const unsigned char SNAPSHOT_BLOCK = 4; // Header of a snapshot: its name and the entry blocks of its files.
+const unsigned char SNAPSHOT_DATA_BLOCK = 5; // Entry or data block no longer used by live files, kept for snapshots.
+
+const unsigned int FAT_MAGIC = 0x5441464d; // "MFAT", first bytes of block 0.
+
+// Locks for read-modify-write of partial sectors in direct I/O mode; each
+// sector of a disk file hashes to one of them.
+const int FAT_DIRECT_LOCK_COUNT = 64;
+
+// Allocation group: a range of blocks with its own allocator lock.
+typedef struct t_FAT_GROUP {
+	int first_block;
+	int end_block; // One past the last block.
+	int next_free; // Free index: all blocks of the group below it are in use.
+	pthread_mutex_t lock; // Protects block_map entries of the group.
+} FAT_GROUP;
+
+// One disk file of a mirrored disk, see mini_fat_create_mirrored.
+typedef struct t_FAT_REPLICA {
+	const char * filename;
+	int fd;
+	int queue_depth; // Reads in progress, reads go to the replica with the fewest.
+	bool is_stale; // Missed writes: neither read nor written until mini_fat_resync.
+	std::vector<bool> missed_blocks; // Blocks to copy from an up-to-date replica at the next resync.
+} FAT_REPLICA;
+
+const int MAX_SNAPSHOT_NAME_LENGTH = 64;
+
+// Read-only point-in-time copy of the files of a disk, see mini_fat_create_snapshot.
+typedef struct t_FAT_SNAPSHOT {
+	char name[MAX_SNAPSHOT_NAME_LENGTH];
+	long long created; // Seconds since the epoch.
+	std::vector<int> header_block_ids; // SNAPSHOT_BLOCKs holding the header, in order.
+	std::vector<int> entry_block_ids; // Entry blocks of the files, as they were.
+	std::vector<int> block_ids; // Every block the snapshot reads: entries and data within file sizes.
+} FAT_SNAPSHOT;
 
 // Feel free to modify this structure.
 typedef struct t_FAT_FILESYSTEM {
@@ -18,8 +56,71 @@ typedef struct t_FAT_FILESYSTEM {
 	std::vector<unsigned char> block_map;
 
 	std::vector<FAT_FILE*> files;
+
+	int fd; // Descriptor of the (first) virtual disk file, kept open for block I/O.
+	std::vector<int> stripe_fds; // All disk files; block b lives in stripe_fds[b % stripe count].
+	std::vector<const char *> stripe_filenames;
+	const unsigned char * map; // Read-only shared mapping of the whole disk, NULL if mmap failed.
+	unsigned int generation; // Count of metadata writes, tells which replica of a mirrored disk is newest.
+
+	std::vector<FAT_REPLICA> replicas; // Copies of the disk file of a mirrored disk, empty otherwise.
+	pthread_mutex_t replica_lock; // Protects the state of the replicas.
+
+	bool discard; // Punch holes in the disk file for freed blocks, so it shrinks on the host (off by default).
+
+	// Log-structured mode, see mini_fat_set_log_structured (off by default).
+	bool log_structured;
+	int segment_blocks; // Blocks per segment, the unit of cleaning.
+	int log_head; // Next block to append to, -1 before the first append.
+	// Old copies of blocks the log moved. The entries and block map on disk may still point to them, so they are
+	// freed only by the next checkpoint (guarded by log_lock).
+	std::vector<int> log_pending_free;
+
+	std::vector<FAT_GROUP> groups; // See mini_fat_set_allocation_groups.
+	int group_blocks; // Blocks per group (the last one may be shorter).
+
+	std::vector<FAT_SNAPSHOT> snapshots;
+	std::vector<bool> snapshot_blocks; // Blocks held by a snapshot, copied before live files overwrite them.
+	const char * mounted_snapshot; // Name of the snapshot whose files are loaded (read-only), NULL for the live disk.
+	std::string base_filename; // Disk file of a snapshot mounted as "disk@name".
+
+	// Shared by API calls; exclusive for save, resize and the log cleaner, which move blocks, and for deletes, which
+	// free the file. Changes to one file are serialized by its own lock (FAT_FILE.lock).
+	pthread_rwlock_t lock;
+	pthread_mutex_t files_lock; // Protects files.
+	pthread_mutex_t log_lock; // Protects log_head, log_pending_free and, in log-structured mode, block_map.
+	pthread_mutex_t cleaner_lock;
+	pthread_cond_t cleaner_wakeup;
+	pthread_t cleaner;
+	bool is_cleaner_running;
+
+	bool direct_io; // Disk files opened with O_DIRECT, see mini_fat_set_direct_io.
+	std::vector<char *> direct_buffers; // Free aligned buffers for unaligned direct I/O.
+	pthread_mutex_t buffer_lock; // Protects direct_buffers.
+	pthread_mutex_t direct_locks[FAT_DIRECT_LOCK_COUNT]; // Serialize read-modify-write of partial sectors, by sector.
 } FAT_FILESYSTEM;
 
+// Holds the lock of a disk (shared or exclusive) for the lifetime of the object.
+struct FAT_LOCK {
+	FAT_FILESYSTEM * fs;
+	FAT_LOCK(FAT_FILESYSTEM * fs, const bool is_exclusive = false) : fs(fs) {
+		if (is_exclusive)
+			pthread_rwlock_wrlock(&fs->lock);
+		else
+			pthread_rwlock_rdlock(&fs->lock);
+	}
+	~FAT_LOCK() { pthread_rwlock_unlock(&fs->lock); }
+};
+
+// One piece of a multi-block transfer, see mini_fat_transfer_blocks.
+typedef struct t_FAT_BLOCK_IO {
+	int block_id;
+	int block_offset;
+	int size; // Must fit inside the block.
+	char * buffer;
+	int transferred; // Set by the transfer.
+} FAT_BLOCK_IO;
+
 
 /// Public APIs
 // DO NOT MODIFY THE FOLLOWING:
@@ -31,9 +132,51 @@ void mini_fat_dump(const FAT_FILESYSTEM *fat);
 
 // Helpers (not mandatory):
 int mini_fat_find_empty_block(const FAT_FILESYSTEM *fat);
-int mini_fat_allocate_new_block(FAT_FILESYSTEM *fs, const unsigned char block_type);
+int mini_fat_allocate_new_block(FAT_FILESYSTEM *fs, const unsigned char block_type, const int hint);
+void mini_fat_free_blocks(FAT_FILESYSTEM *fs, std::vector<int> block_ids);
+bool mini_fat_allocate_blocks(FAT_FILESYSTEM *fs, const int count, const unsigned char block_type, const int hint, std::vector<int> &block_ids);
 int mini_fat_write_in_block(FAT_FILESYSTEM *fs, const int block_id, const int block_offset, const int size, const void * buffer);
 int mini_fat_read_in_block(FAT_FILESYSTEM *fs, const int block_id, const int block_offset, const int size, void * buffer);
+int mini_fat_transfer_blocks(FAT_FILESYSTEM *fs, std::vector<FAT_BLOCK_IO> &ios, const bool is_write);
+int mini_fat_copy_range(FAT_FILESYSTEM *fs, const int src_block, const int src_offset, const int dst_block, const int dst_offset, const int size);
+int mini_fat_copy_to_fd(FAT_FILESYSTEM *fs, const int block_id, const int block_offset, const int size, const int host_fd);
+int mini_fat_copy_from_fd(FAT_FILESYSTEM *fs, const int host_fd, const int block_id, const int block_offset, const int size);
+bool mini_fat_write_metadata(FAT_FILESYSTEM *fs, const std::vector<FAT_FILE *> &files, const bool is_checkpoint = false);
+bool mini_fat_resize(FAT_FILESYSTEM *fs, const int new_block_count);
+int mini_fat_metadata_block_count(const int block_size, const int block_count);
+void mini_fat_close(FAT_FILESYSTEM *fs);
+
+bool mini_fat_set_direct_io(FAT_FILESYSTEM *fs, const bool enable);
+
+// Allocation groups:
+bool mini_fat_set_allocation_groups(FAT_FILESYSTEM *fs, const int group_count);
+int mini_fat_block_group(const FAT_FILESYSTEM *fs, const int block_id);
+int mini_fat_thread_group(const FAT_FILESYSTEM *fs);
+
+// Striped disks, spanning several disk files:
+FAT_FILESYSTEM * mini_fat_create_striped(const std::vector<const char *> &filenames, const int block_size, const int block_count);
+FAT_FILESYSTEM * mini_fat_load_striped(const std::vector<const char *> &filenames);
+FAT_FILESYSTEM * mini_fat_load_snapshot(const std::vector<const char *> &filenames, const char * name);
+
+// Mirrored disks, every disk file holding a full copy:
+FAT_FILESYSTEM * mini_fat_create_mirrored(const std::vector<const char *> &filenames, const int block_size, const int block_count);
+FAT_FILESYSTEM * mini_fat_load_mirrored(const std::vector<const char *> &filenames);
+int mini_fat_resync(FAT_FILESYSTEM *fs);
+
+// Log-structured mode (fat_log.cpp):
+bool mini_fat_set_log_structured(FAT_FILESYSTEM *fs, const int segment_blocks);
+int mini_fat_log_clean(FAT_FILESYSTEM *fs, const int clean_segments);
+int mini_fat_log_next_block(FAT_FILESYSTEM *fs, const int avoid_segment);
+int mini_fat_log_relocate(FAT_FILESYSTEM *fs, const int block_id, const bool keep_contents);
+void mini_fat_log_stop_cleaner(FAT_FILESYSTEM *fs);
+
+// Snapshots (fat_snapshot.cpp):
+bool mini_fat_create_snapshot(FAT_FILESYSTEM *fs, const char * name);
+bool mini_fat_delete_snapshot(FAT_FILESYSTEM *fs, const char * name);
+void mini_fat_load_snapshots(FAT_FILESYSTEM *fs);
+bool mini_fat_mount_snapshot(FAT_FILESYSTEM *fs, const char * name);
+bool mini_fat_snapshot_unshare(FAT_FILESYSTEM *fs, const std::vector<int*> &blocks, const std::vector<bool> &keep_contents);
+bool mini_fat_is_read_only(const FAT_FILESYSTEM *fs);
 
 
-#endif //FAT_H
\ No newline at end of file
+#endif //FAT_H
@@ -0,0 +1,424 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+#include <math.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "fat.h"
+#include "fat_file.h"
+
+// Trace-driven benchmark of the FAT library. A trace is a list of file
+// operations per thread; it is either generated from a file size
+// distribution and an operation mix, or replayed from a file written by an
+// earlier run. Every thread replays its own operations on the shared disk,
+// each operation is timed, and throughput and latency percentiles are
+// reported per operation type.
+//
+// Trace file format, one operation per line ('#' starts a comment):
+//   <thread> open <file> r|w
+//   <thread> write <file> <bytes>     (at the current position)
+//   <thread> read <file> <bytes>
+//   <thread> seek <file> <offset>     (from the start)
+//   <thread> close <file>
+//   <thread> delete <file>
+
+enum BENCH_OP_TYPE { OP_OPEN, OP_WRITE, OP_READ, OP_SEEK, OP_CLOSE, OP_DELETE, OP_TYPE_COUNT };
+static const char * op_names[OP_TYPE_COUNT] = {"open", "write", "read", "seek", "close", "delete"};
+
+typedef struct t_BENCH_OP {
+	int type;
+	std::string file;
+	int value; // Bytes for read/write, offset for seek, 1 for write mode on open.
+} BENCH_OP;
+
+// Operations of one thread, and what replaying them measured.
+typedef struct t_BENCH_THREAD {
+	FAT_FILESYSTEM * fs;
+	std::vector<BENCH_OP> ops;
+	int io_size; // Largest read or write.
+	std::vector<double> latencies[OP_TYPE_COUNT]; // Microseconds.
+	long long bytes_read;
+	long long bytes_written;
+	int failures;
+} BENCH_THREAD;
+
+// File size distribution of generated traces.
+typedef struct t_BENCH_SIZES {
+	char kind; // 'f'ixed, 'u'niform or 'e'xponential.
+	int min; // Size for fixed, mean for exponential.
+	int max;
+} BENCH_SIZES;
+
+static double now_microseconds() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int random_size(const BENCH_SIZES * sizes, unsigned int * seed) {
+	if (sizes->kind == 'u')
+		return sizes->min + rand_r(seed) % (sizes->max - sizes->min + 1);
+	if (sizes->kind == 'e') {
+		double uniform = (rand_r(seed) + 1.0) / (RAND_MAX + 2.0);
+		return (int)(-sizes->min * log(uniform));
+	}
+	return sizes->min;
+}
+
+static bool parse_sizes(const char * text, BENCH_SIZES * sizes) {
+	if (sscanf(text, "fixed:%d", &sizes->min) == 1) {
+		sizes->kind = 'f';
+		return sizes->min >= 0;
+	}
+	if (sscanf(text, "uniform:%d:%d", &sizes->min, &sizes->max) == 2) {
+		sizes->kind = 'u';
+		return sizes->min >= 0 && sizes->max >= sizes->min;
+	}
+	if (sscanf(text, "exp:%d", &sizes->min) == 1) {
+		sizes->kind = 'e';
+		return sizes->min > 0;
+	}
+	return false;
+}
+
+// Generator view of one file of a thread.
+typedef struct t_BENCH_FILE {
+	std::string name;
+	bool exists;
+	int size;
+	int target_size; // Appends stop here, then writes overwrite.
+	int open_mode; // -1 closed, 0 read, 1 write.
+	int position;
+} BENCH_FILE;
+
+static void emit(std::vector<BENCH_OP> & ops, const int type, const BENCH_FILE & file, const int value) {
+	BENCH_OP op = {type, file.name, value};
+	ops.push_back(op);
+}
+
+// Open a file in the given mode, closing it first if it is open otherwise.
+static void generate_open(std::vector<BENCH_OP> & ops, BENCH_FILE & file, const int mode) {
+	if (file.open_mode == mode)
+		return;
+	if (file.open_mode != -1)
+		emit(ops, OP_CLOSE, file, 0);
+	emit(ops, OP_OPEN, file, mode);
+	file.open_mode = mode;
+	file.exists = true;
+	file.position = mode == 1 ? file.size : 0; // Write handles append.
+}
+
+/**
+ * Generate op_count operations on files_per_thread files for one thread.
+ * Writes first grow each file to a size drawn from the distribution, then
+ * overwrite it at random offsets. Reads go sequentially, wrapping around.
+ */
+static void generate_thread(BENCH_THREAD * thread, const int index, const int op_count, const int files_per_thread,
+	const BENCH_SIZES * sizes, const int read_percent, const int delete_percent, const int seek_percent) {
+	unsigned int seed = 12345 + index;
+	std::vector<BENCH_FILE> files(files_per_thread);
+	for (int i=0; i<files_per_thread; ++i) {
+		char name[64];
+		sprintf(name, "t%d_f%d", index, i);
+		BENCH_FILE file = {name, false, 0, random_size(sizes, &seed), -1, 0};
+		files[i] = file;
+	}
+
+	std::vector<BENCH_OP> & ops = thread->ops;
+	while ((int)ops.size() < op_count) {
+		BENCH_FILE & file = files[rand_r(&seed) % files_per_thread];
+		int dice = rand_r(&seed) % 100;
+		if (dice < delete_percent && file.exists) {
+			if (file.open_mode != -1)
+				emit(ops, OP_CLOSE, file, 0);
+			emit(ops, OP_DELETE, file, 0);
+			file.exists = false;
+			file.open_mode = -1;
+			file.size = 0;
+			file.target_size = random_size(sizes, &seed);
+		} else if (dice < delete_percent + seek_percent && file.exists) {
+			if (file.open_mode == -1)
+				generate_open(ops, file, 0);
+			file.position = file.size > 0 ? rand_r(&seed) % (file.size + 1) : 0;
+			emit(ops, OP_SEEK, file, file.position);
+		} else if (dice < delete_percent + seek_percent + read_percent && file.exists && file.size > 0) {
+			generate_open(ops, file, 0);
+			if (file.position >= file.size) {
+				file.position = 0;
+				emit(ops, OP_SEEK, file, 0);
+			}
+			int bytes = std::min(thread->io_size, file.size - file.position);
+			emit(ops, OP_READ, file, bytes);
+			file.position += bytes;
+		} else {
+			generate_open(ops, file, 1);
+			if (file.size >= file.target_size && file.size > 0) {
+				file.position = rand_r(&seed) % file.size;
+				emit(ops, OP_SEEK, file, file.position);
+			}
+			int bytes = thread->io_size;
+			if (file.size < file.target_size)
+				bytes = std::min(bytes, file.target_size - file.size);
+			emit(ops, OP_WRITE, file, bytes);
+			file.position += bytes;
+			file.size = std::max(file.size, file.position);
+		}
+	}
+	for (int i=0; i<files_per_thread; ++i) {
+		if (files[i].open_mode != -1)
+			emit(ops, OP_CLOSE, files[i], 0);
+	}
+}
+
+static bool save_trace(const char * path, const std::vector<BENCH_THREAD> & threads) {
+	FILE * out = fopen(path, "w");
+	if (out == NULL) {
+		perror("Cannot write trace");
+		return false;
+	}
+	fprintf(out, "# minifs trace: %d threads\n", (int)threads.size());
+	for (int i=0; i<(int)threads.size(); ++i) {
+		for (int j=0; j<(int)threads[i].ops.size(); ++j) {
+			const BENCH_OP & op = threads[i].ops[j];
+			fprintf(out, "%d %s %s", i, op_names[op.type], op.file.c_str());
+			if (op.type == OP_OPEN)
+				fprintf(out, " %c", op.value ? 'w' : 'r');
+			else if (op.type == OP_WRITE || op.type == OP_READ || op.type == OP_SEEK)
+				fprintf(out, " %d", op.value);
+			fprintf(out, "\n");
+		}
+	}
+	fclose(out);
+	return true;
+}
+
+static bool load_trace(const char * path, std::vector<BENCH_THREAD> & threads) {
+	FILE * in = fopen(path, "r");
+	if (in == NULL) {
+		perror("Cannot read trace");
+		return false;
+	}
+	char line[1024];
+	int line_number = 0;
+	while (fgets(line, sizeof(line), in)) {
+		line_number++;
+		char name[16], file[MAX_FILENAME_LENGTH], argument[32] = "";
+		int thread;
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+		int fields = sscanf(line, "%d %15s %255s %31s", &thread, name, file, argument);
+		int type = 0;
+		while (type < OP_TYPE_COUNT && strcmp(op_names[type], name) != 0)
+			type++;
+		if (fields < 3 || thread < 0 || type == OP_TYPE_COUNT) {
+			fprintf(stderr, "Cannot read trace: bad operation on line %d.\n", line_number);
+			fclose(in);
+			return false;
+		}
+
+		if (thread >= (int)threads.size())
+			threads.resize(thread + 1);
+		BENCH_OP op = {type, file, type == OP_OPEN ? argument[0] == 'w' : atoi(argument)};
+		threads[thread].ops.push_back(op);
+		if ((type == OP_READ || type == OP_WRITE) && op.value > threads[thread].io_size)
+			threads[thread].io_size = op.value;
+	}
+	fclose(in);
+	return true;
+}
+
+static void * replay_thread(void * arg) {
+	BENCH_THREAD * thread = (BENCH_THREAD *)arg;
+	FAT_FILESYSTEM * fs = thread->fs;
+	std::map<std::string, FAT_OPEN_FILE *> handles;
+	std::vector<char> buffer(thread->io_size > 0 ? thread->io_size : 1);
+	for (int i=0; i<(int)buffer.size(); ++i)
+		buffer[i] = 'a' + i % 26;
+
+	for (int i=0; i<(int)thread->ops.size(); ++i) {
+		const BENCH_OP & op = thread->ops[i];
+		FAT_OPEN_FILE * handle = handles.count(op.file) ? handles[op.file] : NULL;
+		bool is_done = true;
+		double start = now_microseconds();
+		switch (op.type) {
+			case OP_OPEN:
+				handle = mini_file_open(fs, op.file.c_str(), op.value);
+				is_done = handle != NULL;
+				if (is_done)
+					handles[op.file] = handle;
+				break;
+			case OP_WRITE: {
+				int written = handle ? mini_file_write(fs, handle, op.value, &buffer[0]) : 0;
+				thread->bytes_written += written;
+				is_done = written == op.value;
+				break;
+			}
+			case OP_READ: {
+				int read = handle ? mini_file_read(fs, handle, op.value, &buffer[0]) : 0;
+				thread->bytes_read += read;
+				is_done = read == op.value;
+				break;
+			}
+			case OP_SEEK:
+				is_done = handle && mini_file_seek(fs, handle, op.value, true);
+				break;
+			case OP_CLOSE:
+				is_done = handle && mini_file_close(fs, handle);
+				delete handle;
+				handles.erase(op.file);
+				break;
+			case OP_DELETE:
+				is_done = mini_file_delete(fs, op.file.c_str());
+				break;
+		}
+		thread->latencies[op.type].push_back(now_microseconds() - start);
+		thread->failures += !is_done;
+	}
+
+	for (std::map<std::string, FAT_OPEN_FILE *>::iterator it=handles.begin(); it!=handles.end(); ++it) {
+		mini_file_close(fs, it->second);
+		delete it->second;
+	}
+	return NULL;
+}
+
+static double percentile(const std::vector<double> & sorted, const double fraction) {
+	int index = (int)(fraction * (sorted.size() - 1) + 0.5);
+	return sorted[index];
+}
+
+static void report_latencies(const char * name, std::vector<double> & latencies) {
+	if (latencies.empty())
+		return;
+	std::sort(latencies.begin(), latencies.end());
+	printf("%-8s %9d %9.1f %9.1f %9.1f %9.1f %9.1f\n", name, (int)latencies.size(),
+		percentile(latencies, 0.5), percentile(latencies, 0.9), percentile(latencies, 0.99),
+		percentile(latencies, 0.999), latencies.back());
+}
+
+static void usage() {
+	fprintf(stderr, "Usage: ./minifs_bench [options] disk\n"
+		"  -b block_size -n block_count   geometry of the new disk (default 4096 x 16384)\n"
+		"  -t threads                     threads of a generated trace (default 4)\n"
+		"  -o ops                         operations per thread (default 10000)\n"
+		"  -f files                       files per thread (default 16)\n"
+		"  -s fixed:N|uniform:MIN:MAX|exp:MEAN   file sizes (default uniform:4096:262144)\n"
+		"  -i io_size                     bytes per read or write (default 4096)\n"
+		"  -r read%% -x delete%% -k seek%%   operation mix, the rest are writes (default 40, 1, 5)\n"
+		"  -g trace                       save the generated trace\n"
+		"  -p trace                       replay a trace instead of generating one\n"
+		"  -G groups -L segment_blocks -D disk options: allocation groups, log-structured, O_DIRECT\n");
+	exit(1);
+}
+
+int main(int argc, char * argv[])
+{
+	int block_size = 4096, block_count = 16384, thread_count = 4, op_count = 10000, files_per_thread = 16;
+	int io_size = 4096, read_percent = 40, delete_percent = 1, seek_percent = 5;
+	int groups = 1, segment_blocks = 0;
+	bool direct_io = false;
+	const char * save_path = NULL;
+	const char * replay_path = NULL;
+	BENCH_SIZES sizes = {'u', 4096, 262144};
+	int option;
+	while ((option = getopt(argc, argv, "b:n:t:o:f:s:i:r:x:k:g:p:G:L:D")) != -1) {
+		switch (option) {
+			case 'b': block_size = atoi(optarg); break;
+			case 'n': block_count = atoi(optarg); break;
+			case 't': thread_count = atoi(optarg); break;
+			case 'o': op_count = atoi(optarg); break;
+			case 'f': files_per_thread = atoi(optarg); break;
+			case 's': if (!parse_sizes(optarg, &sizes)) usage(); break;
+			case 'i': io_size = atoi(optarg); break;
+			case 'r': read_percent = atoi(optarg); break;
+			case 'x': delete_percent = atoi(optarg); break;
+			case 'k': seek_percent = atoi(optarg); break;
+			case 'g': save_path = optarg; break;
+			case 'p': replay_path = optarg; break;
+			case 'G': groups = atoi(optarg); break;
+			case 'L': segment_blocks = atoi(optarg); break;
+			case 'D': direct_io = true; break;
+			default: usage();
+		}
+	}
+	if (argc - optind != 1 || block_size <= 0 || block_count <= 0 || thread_count < 1 || op_count < 1
+		|| files_per_thread < 1 || io_size < 1 || read_percent + delete_percent + seek_percent > 100)
+		usage();
+
+	std::vector<BENCH_THREAD> threads;
+	if (replay_path) {
+		if (!load_trace(replay_path, threads))
+			return 1;
+	} else {
+		threads.resize(thread_count);
+		for (int i=0; i<thread_count; ++i) {
+			threads[i].io_size = io_size;
+			generate_thread(&threads[i], i, op_count, files_per_thread, &sizes, read_percent, delete_percent, seek_percent);
+		}
+		long long total_size = (long long)thread_count * files_per_thread * (sizes.kind == 'u' ? (sizes.min + sizes.max) / 2 : sizes.min);
+		if (total_size > (long long)block_size * block_count)
+			fprintf(stderr, "Warning: files average %lld bytes in total, more than the disk holds.\n", total_size);
+		if (save_path && !save_trace(save_path, threads))
+			return 1;
+	}
+
+	FAT_FILESYSTEM * fs = mini_fat_create(argv[optind], block_size, block_count);
+	if (fs == NULL)
+		return 1;
+	if ((groups > 1 && !mini_fat_set_allocation_groups(fs, groups))
+		|| (segment_blocks > 0 && !mini_fat_set_log_structured(fs, segment_blocks))
+		|| (direct_io && !mini_fat_set_direct_io(fs, true))) {
+		mini_fat_close(fs);
+		return 1;
+	}
+
+	int op_total = 0;
+	for (int i=0; i<(int)threads.size(); ++i) {
+		threads[i].fs = fs;
+		threads[i].bytes_read = threads[i].bytes_written = 0;
+		threads[i].failures = 0;
+		op_total += threads[i].ops.size();
+	}
+
+	double start = now_microseconds();
+	std::vector<pthread_t> ids(threads.size());
+	for (int i=0; i<(int)threads.size(); ++i)
+		pthread_create(&ids[i], NULL, replay_thread, &threads[i]);
+	for (int i=0; i<(int)threads.size(); ++i)
+		pthread_join(ids[i], NULL);
+	double seconds = (now_microseconds() - start) / 1e6;
+	mini_fat_close(fs);
+
+	long long bytes_read = 0, bytes_written = 0;
+	int failures = 0;
+	std::vector<double> all;
+	std::vector<double> by_type[OP_TYPE_COUNT];
+	for (int i=0; i<(int)threads.size(); ++i) {
+		bytes_read += threads[i].bytes_read;
+		bytes_written += threads[i].bytes_written;
+		failures += threads[i].failures;
+		for (int j=0; j<OP_TYPE_COUNT; ++j) {
+			by_type[j].insert(by_type[j].end(), threads[i].latencies[j].begin(), threads[i].latencies[j].end());
+			all.insert(all.end(), threads[i].latencies[j].begin(), threads[i].latencies[j].end());
+		}
+	}
+
+	printf("Replayed %d ops on %d threads in %.3f s: %.1f ops/s, %.2f MB/s (%.2f MB read, %.2f MB written)",
+		op_total, (int)threads.size(), seconds, op_total / seconds,
+		(bytes_read + bytes_written) / seconds / (1024.0 * 1024.0),
+		bytes_read / (1024.0 * 1024.0), bytes_written / (1024.0 * 1024.0));
+	if (failures > 0)
+		printf(", %d failed", failures);
+	printf("\n%-8s %9s %9s %9s %9s %9s %9s\n", "op", "count", "p50 us", "p90 us", "p99 us", "p99.9 us", "max us");
+	for (int i=0; i<OP_TYPE_COUNT; ++i)
+		report_latencies(op_names[i], by_type[i]);
+	report_latencies("all", all);
+	return 0;
+}
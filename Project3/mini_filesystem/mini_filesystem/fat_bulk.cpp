@@ -0,0 +1,382 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <queue>
+#include <string>
+#include <vector>
+
+#include "fat.h"
+#include "fat_file.h"
+
+// Bulk import/export between a host directory tree and a virtual disk.
+// Host file I/O runs on a pool of threads, while the virtual disk is driven
+// by a single thread. Both sides are connected through a bounded queue, so
+// the pool reads (or writes) host files while the disk thread is busy.
+
+typedef struct t_BULK_ITEM {
+	std::string name; // Path relative to the host directory, also the file name inside the disk.
+	std::vector<char> data;
+} BULK_ITEM;
+
+// Bounded blocking queue between the host threads and the disk thread.
+typedef struct t_BULK_QUEUE {
+	std::queue<BULK_ITEM*> items;
+	int capacity;
+	int producers; // Producers still running; pop returns NULL once this is zero and the queue is empty.
+	pthread_mutex_t lock;
+	pthread_cond_t not_full;
+	pthread_cond_t not_empty;
+} BULK_QUEUE;
+
+// State shared by the host threads.
+typedef struct t_BULK_JOB {
+	const char * directory;
+	std::vector<std::string> names;
+	int next_name; // Next entry of names to import (guarded by queue.lock).
+	int failures; // Guarded by queue.lock.
+	long long bytes; // Bytes exported to host files, counted once written (guarded by queue.lock).
+	BULK_QUEUE queue;
+} BULK_JOB;
+
+static void bulk_queue_init(BULK_QUEUE * queue, const int capacity, const int producers) {
+	queue->capacity = capacity;
+	queue->producers = producers;
+	pthread_mutex_init(&queue->lock, NULL);
+	pthread_cond_init(&queue->not_full, NULL);
+	pthread_cond_init(&queue->not_empty, NULL);
+}
+
+static void bulk_queue_push(BULK_QUEUE * queue, BULK_ITEM * item) {
+	pthread_mutex_lock(&queue->lock);
+	while ((int)queue->items.size() >= queue->capacity)
+		pthread_cond_wait(&queue->not_full, &queue->lock);
+	queue->items.push(item);
+	pthread_cond_signal(&queue->not_empty);
+	pthread_mutex_unlock(&queue->lock);
+}
+
+// Blocks until an item is available. Returns NULL when all producers are done.
+static BULK_ITEM * bulk_queue_pop(BULK_QUEUE * queue) {
+	pthread_mutex_lock(&queue->lock);
+	while (queue->items.empty() && queue->producers > 0)
+		pthread_cond_wait(&queue->not_empty, &queue->lock);
+	BULK_ITEM * item = NULL;
+	if (!queue->items.empty()) {
+		item = queue->items.front();
+		queue->items.pop();
+		pthread_cond_signal(&queue->not_full);
+	}
+	pthread_mutex_unlock(&queue->lock);
+	return item;
+}
+
+static void bulk_queue_producer_done(BULK_QUEUE * queue) {
+	pthread_mutex_lock(&queue->lock);
+	queue->producers--;
+	pthread_cond_broadcast(&queue->not_empty);
+	pthread_mutex_unlock(&queue->lock);
+}
+
+static void bulk_job_failed(BULK_JOB * job) {
+	pthread_mutex_lock(&job->queue.lock);
+	job->failures++;
+	pthread_mutex_unlock(&job->queue.lock);
+}
+
+static double now_seconds() {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static bool read_host_file(const std::string & path, std::vector<char> & data) {
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		perror(path.c_str());
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		perror(path.c_str());
+		close(fd);
+		return false;
+	}
+	if (st.st_size > INT_MAX) {
+		fprintf(stderr, "Cannot import '%s': file is larger than 2 GiB.\n", path.c_str());
+		close(fd);
+		return false;
+	}
+	data.resize(st.st_size);
+	size_t done = 0;
+	while (done < data.size()) {
+		ssize_t n = read(fd, &data[done], data.size() - done);
+		if (n <= 0) {
+			if (n < 0) perror(path.c_str());
+			data.resize(done);
+			break;
+		}
+		done += n;
+	}
+	close(fd);
+	return true;
+}
+
+// Create every missing parent directory of path (like mkdir -p on dirname).
+static void make_parent_directories(const std::string & path) {
+	for (size_t i = path.find('/', 1); i != std::string::npos; i = path.find('/', i + 1)) {
+		std::string parent = path.substr(0, i);
+		if (mkdir(parent.c_str(), 0755) != 0 && errno != EEXIST)
+			perror(parent.c_str());
+	}
+}
+
+static bool write_host_file(const std::string & path, const std::vector<char> & data) {
+	make_parent_directories(path);
+	int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		perror(path.c_str());
+		return false;
+	}
+	size_t done = 0;
+	while (done < data.size()) {
+		ssize_t n = write(fd, &data[done], data.size() - done);
+		if (n <= 0) {
+			perror(path.c_str());
+			close(fd);
+			return false;
+		}
+		done += n;
+	}
+	close(fd);
+	return true;
+}
+
+// Collect regular files below directory/relative, as paths relative to directory.
+static void collect_host_files(const char * directory, const std::string & relative, std::vector<std::string> & names) {
+	std::string path = relative.empty() ? directory : std::string(directory) + "/" + relative;
+	DIR * dir = opendir(path.c_str());
+	if (dir == NULL) {
+		perror(path.c_str());
+		return;
+	}
+	struct dirent * entry;
+	while ((entry = readdir(dir)) != NULL) {
+		if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+			continue;
+		std::string name = relative.empty() ? entry->d_name : relative + "/" + entry->d_name;
+		struct stat st;
+		if (lstat((std::string(directory) + "/" + name).c_str(), &st) != 0)
+			continue;
+		if (S_ISDIR(st.st_mode)) {
+			collect_host_files(directory, name, names);
+		} else if (S_ISREG(st.st_mode)) {
+			if (name.size() >= (size_t)MAX_FILENAME_LENGTH) {
+				fprintf(stderr, "Skipping '%s': name is too long.\n", name.c_str());
+				continue;
+			}
+			names.push_back(name);
+		}
+	}
+	closedir(dir);
+}
+
+// Import reader: read host files and hand them to the disk thread.
+static void * import_reader(void * arg) {
+	BULK_JOB * job = (BULK_JOB *)arg;
+	while (true) {
+		pthread_mutex_lock(&job->queue.lock);
+		int index = job->next_name < (int)job->names.size() ? job->next_name++ : -1;
+		pthread_mutex_unlock(&job->queue.lock);
+		if (index == -1)
+			break;
+
+		BULK_ITEM * item = new BULK_ITEM;
+		item->name = job->names[index];
+		if (!read_host_file(std::string(job->directory) + "/" + item->name, item->data)) {
+			bulk_job_failed(job);
+			delete item;
+			continue;
+		}
+		bulk_queue_push(&job->queue, item);
+	}
+	bulk_queue_producer_done(&job->queue);
+	return NULL;
+}
+
+// Export writer: write files read from the disk to the host directory.
+static void * export_writer(void * arg) {
+	BULK_JOB * job = (BULK_JOB *)arg;
+	BULK_ITEM * item;
+	while ((item = bulk_queue_pop(&job->queue)) != NULL) {
+		if (write_host_file(std::string(job->directory) + "/" + item->name, item->data)) {
+			pthread_mutex_lock(&job->queue.lock);
+			job->bytes += item->data.size();
+			pthread_mutex_unlock(&job->queue.lock);
+		} else {
+			bulk_job_failed(job);
+		}
+		delete item;
+	}
+	return NULL;
+}
+
+static void report(const char * action, const int files, const long long bytes, const int failures, const double seconds) {
+	printf("%s %d files, %lld bytes in %.3f s: %.1f files/s, %.2f MB/s", action, files, bytes, seconds,
+		files / seconds, bytes / seconds / (1024.0 * 1024.0));
+	if (failures > 0)
+		printf(", %d failed", failures);
+	printf("\n");
+}
+
+static int bulk_import(FAT_FILESYSTEM * fs, BULK_JOB * job, const int threads, const int batch) {
+	double start = now_seconds();
+	collect_host_files(job->directory, "", job->names);
+
+	std::vector<pthread_t> readers(threads);
+	for (int i=0; i<threads; ++i)
+		pthread_create(&readers[i], NULL, import_reader, job);
+
+	// The disk thread preallocates each file as one run, writes it with a
+	// single write call and saves the metadata once per batch. Files that
+	// fail are deleted again, so no empty or partial copy is left behind.
+	int files = 0, pending = 0, failures = 0;
+	long long bytes = 0;
+	BULK_ITEM * item;
+	while ((item = bulk_queue_pop(&job->queue)) != NULL) {
+		const char * name = item->name.c_str();
+		if (mini_file_find(fs, name))
+			mini_file_delete(fs, name); // Overwrite files already on the disk.
+		FAT_OPEN_FILE * open_file = mini_file_open(fs, name, true);
+		int size = item->data.size();
+		int written = -1;
+		if (!open_file)
+			fprintf(stderr, "Cannot import '%s': cannot open it for writing.\n", name);
+		else if (!mini_file_preallocate(fs, open_file, size))
+			fprintf(stderr, "Cannot import '%s': disk is full.\n", name);
+		else if ((written = mini_file_write(fs, open_file, size, item->data.data())) != size)
+			fprintf(stderr, "Cannot import '%s': wrote %d of %d bytes.\n", name, written, size);
+		mini_file_close(fs, open_file);
+		if (written == size) {
+			files++;
+			bytes += written;
+		} else {
+			if (open_file)
+				mini_file_delete(fs, name);
+			failures++;
+		}
+		delete item;
+
+		if (++pending >= batch) {
+			mini_fat_save(fs);
+			pending = 0;
+		}
+	}
+	for (int i=0; i<threads; ++i)
+		pthread_join(readers[i], NULL);
+	bool saved = mini_fat_save(fs);
+
+	report("Imported", files, bytes, failures + job->failures, now_seconds() - start);
+	return saved && failures + job->failures == 0 ? 0 : 1;
+}
+
+static int bulk_export(FAT_FILESYSTEM * fs, BULK_JOB * job, const int threads) {
+	double start = now_seconds();
+	std::vector<pthread_t> writers(threads);
+	for (int i=0; i<threads; ++i)
+		pthread_create(&writers[i], NULL, export_writer, job);
+
+	int files = 0, failures = 0;
+	for (int i=0; i<(int)fs->files.size(); ++i) {
+		FAT_FILE * file = fs->files[i];
+		BULK_ITEM * item = new BULK_ITEM;
+		item->name = file->name;
+		item->data.resize(file->size);
+		FAT_OPEN_FILE * open_file = mini_file_open(fs, file->name, false);
+		int read = open_file ? mini_file_read(fs, open_file, file->size, item->data.data()) : -1;
+		mini_file_close(fs, open_file);
+		if (read != file->size) {
+			fprintf(stderr, "Cannot export '%s': read failed.\n", file->name);
+			failures++;
+			delete item;
+			continue;
+		}
+		files++;
+		bulk_queue_push(&job->queue, item);
+	}
+	bulk_queue_producer_done(&job->queue);
+	for (int i=0; i<threads; ++i)
+		pthread_join(writers[i], NULL);
+
+	report("Exported", files - job->failures, job->bytes, failures + job->failures, now_seconds() - start);
+	return failures + job->failures == 0 ? 0 : 1;
+}
+
+static void usage() {
+	fprintf(stderr, "Usage: ./minifs_bulk import|export disk directory [-t threads] [-q queue_length]\n"
+		"                    [-s batch] [-b block_size -n block_count] [-d]\n"
+		"  -b, -n  import into a new disk with the given geometry instead of an existing one\n"
+		"  -d      access the disk with O_DIRECT, bypassing the page cache\n");
+	exit(1);
+}
+
+int main(int argc, char * argv[])
+{
+	int threads = 4, queue_length = 64, batch = 256, block_size = 0, block_count = 0;
+	bool direct_io = false;
+	int option;
+	while ((option = getopt(argc, argv, "t:q:s:b:n:d")) != -1) {
+		switch (option) {
+			case 't': threads = atoi(optarg); break;
+			case 'q': queue_length = atoi(optarg); break;
+			case 's': batch = atoi(optarg); break;
+			case 'b': block_size = atoi(optarg); break;
+			case 'n': block_count = atoi(optarg); break;
+			case 'd': direct_io = true; break;
+			default: usage();
+		}
+	}
+	if (argc - optind != 3 || threads < 1 || queue_length < 1 || batch < 1)
+		usage();
+
+	const char * mode = argv[optind];
+	const char * disk = argv[optind + 1];
+	bool is_import = strcmp(mode, "import") == 0;
+	if (!is_import && strcmp(mode, "export") != 0)
+		usage();
+
+	FAT_FILESYSTEM * fs;
+	if (is_import && (block_size > 0 || block_count > 0)) {
+		if (block_size <= 0 || block_count <= 0)
+			usage();
+		fs = mini_fat_create(disk, block_size, block_count);
+		if (fs == NULL)
+			return 1;
+	} else {
+		fs = mini_fat_load(disk);
+	}
+	if (direct_io && !mini_fat_set_direct_io(fs, true)) {
+		mini_fat_close(fs);
+		return 1;
+	}
+
+	BULK_JOB job;
+	job.directory = argv[optind + 2];
+	job.next_name = 0;
+	job.failures = 0;
+	job.bytes = 0;
+	bulk_queue_init(&job.queue, queue_length, is_import ? threads : 1);
+
+	int result = is_import ? bulk_import(fs, &job, threads, batch) : bulk_export(fs, &job, threads);
+	mini_fat_close(fs);
+	return result;
+}
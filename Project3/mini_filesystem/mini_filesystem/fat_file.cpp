@@ -1,6 +1,26 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <algorithm>
+
 #include "fat.h"
 #include "fat_file.h"
 
+// A file entry block starts with the file size, name length and extent count,
+// followed by the name (without terminator) and the data blocks stored as
+// (first block, block count) runs. Files without data blocks store their
+// data right after the name instead (inline).
+const int ENTRY_HEADER_SIZE = 3 * sizeof(int);
+
+// mini_file_copy_from_fd reserves blocks for at most this many at a time,
+// since the size of the host input is not known up front.
+const int COPY_RESERVE_BLOCKS = 64;
+
 // Little helper to show debug messages. Set 1 to 0 to silence.
 #define DEBUG 1
 inline void debug(const char * fmt, ...) {
@@ -21,7 +41,7 @@ static void vector_delete_index(std::vector<T> &vector, const int index) {
 // Find var and delete from vector.
 template<typename T>
 static bool vector_delete_value(std::vector<T> &vector, const T var) {
-	for (int i=0; i<vector.size(); ++i) {
+	for (int i=0; i<(int)vector.size(); ++i) {
 		if (vector[i] == var) {
 			vector_delete_index(vector, i);
 			return true;
@@ -34,14 +54,16 @@ void mini_file_dump(const FAT_FILESYSTEM *fs, const FAT_FILE *file)
 {
 	printf("Filename: %s\tFilesize: %d\tBlock count: %d\n", file->name, file->size, (int)file->block_ids.size());
 	printf("\tMetadata block: %d\n", file->metadata_block_id);
+	if (file->block_ids.empty() && file->size > 0)
+		printf("\tData stored inline in the metadata block.\n");
 	printf("\tBlock list: ");
-	for (int i=0; i<file->block_ids.size(); ++i) {
+	for (int i=0; i<(int)file->block_ids.size(); ++i) {
 		printf("%d ", file->block_ids[i]);
 	}
 	printf("\n");
 
 	printf("\tOpen handles: \n");
-	for (int i=0; i<file->open_handles.size(); ++i) {
+	for (int i=0; i<(int)file->open_handles.size(); ++i) {
 		printf("\t\t%d) Position: %d (Block %d, Byte %d), Is Write: %d\n", i,
 			file->open_handles[i]->position,
 			position_to_block_index(fs, file->open_handles[i]->position),
@@ -56,7 +78,7 @@ void mini_file_dump(const FAT_FILESYSTEM *fs, const FAT_FILE *file)
  */
 FAT_FILE * mini_file_find(const FAT_FILESYSTEM *fs, const char *filename)
 {
-	for (int i=0; i<fs->files.size(); ++i) {
+	for (int i=0; i<(int)fs->files.size(); ++i) {
 		if (strcmp(fs->files[i]->name, filename) == 0) // Match
 			return fs->files[i];
 	}
@@ -75,6 +97,92 @@ FAT_FILE * mini_file_create(const char * filename)
 }
 
 
+/**
+ * Encode the metadata of a file (name, size, block list) as stored at the
+ * start of its entry block, into entry (at least fs->block_size bytes).
+ * @return size of the encoded entry, or -1 if it does not fit in one block.
+ */
+int mini_file_encode_entry(const FAT_FILESYSTEM *fs, const FAT_FILE *file, char * entry)
+{
+	std::vector<int> extents; // Pairs of (first block, block count).
+	for (int i=0; i<(int)file->block_ids.size(); ++i) {
+		int block_id = file->block_ids[i];
+		if (!extents.empty() && extents[extents.size()-2] + extents.back() == block_id) {
+			extents.back()++;
+		} else {
+			extents.push_back(block_id);
+			extents.push_back(1);
+		}
+	}
+
+	int name_length = strlen(file->name);
+	int entry_size = ENTRY_HEADER_SIZE + name_length + extents.size() * sizeof(int);
+	if (entry_size > fs->block_size) {
+		fprintf(stderr, "Cannot save file '%s': metadata does not fit in one block.\n", file->name);
+		return -1;
+	}
+
+	int header[3] = {file->size, name_length, (int)extents.size() / 2};
+	memcpy(&entry[0], header, ENTRY_HEADER_SIZE);
+	memcpy(&entry[ENTRY_HEADER_SIZE], file->name, name_length);
+	if (!extents.empty())
+		memcpy(&entry[ENTRY_HEADER_SIZE + name_length], &extents[0], extents.size() * sizeof(int));
+	return entry_size;
+}
+
+/**
+ * Write the metadata of a file (name, size, block list) to its entry block.
+ * @return false if the metadata does not fit in one block or the write fails.
+ */
+bool mini_file_save_entry(FAT_FILESYSTEM *fs, const FAT_FILE *file)
+{
+	std::vector<char> entry(fs->block_size);
+	int entry_size = mini_file_encode_entry(fs, file, &entry[0]);
+	if (entry_size < 0)
+		return false;
+	return mini_fat_write_in_block(fs, file->metadata_block_id, 0, entry_size, &entry[0]) == entry_size;
+}
+
+/**
+ * Read a file entry block back into a new FAT_FILE struct.
+ * @return NULL if the block does not hold a valid entry.
+ */
+FAT_FILE * mini_file_load_entry(FAT_FILESYSTEM *fs, const int block_id)
+{
+	std::vector<char> entry(fs->block_size);
+	if (mini_fat_read_in_block(fs, block_id, 0, fs->block_size, &entry[0]) != fs->block_size) {
+		fprintf(stderr, "Cannot read file entry in block %d.\n", block_id);
+		return NULL;
+	}
+
+	int header[3];
+	memcpy(header, &entry[0], ENTRY_HEADER_SIZE);
+	int name_length = header[1], extent_count = header[2];
+	if (name_length <= 0 || name_length >= MAX_FILENAME_LENGTH || extent_count < 0 ||
+		ENTRY_HEADER_SIZE + name_length + extent_count * 2 * (int)sizeof(int) > fs->block_size) {
+		fprintf(stderr, "Corrupted file entry in block %d.\n", block_id);
+		return NULL;
+	}
+
+	char name[MAX_FILENAME_LENGTH];
+	memcpy(name, &entry[ENTRY_HEADER_SIZE], name_length);
+	name[name_length] = 0;
+
+	FAT_FILE * file = mini_file_create(name);
+	file->size = header[0];
+	file->metadata_block_id = block_id;
+
+	std::vector<int> extents(extent_count * 2);
+	if (extent_count > 0)
+		memcpy(&extents[0], &entry[ENTRY_HEADER_SIZE + name_length], extents.size() * sizeof(int));
+	for (int i=0; i<extent_count; ++i) {
+		for (int j=0; j<extents[2*i+1]; ++j) {
+			file->block_ids.push_back(extents[2*i] + j);
+		}
+	}
+	return file;
+}
+
 /**
  * Create a file and attach it to filesystem.
  * @return FAT_OPEN_FILE pointer on success, NULL on failure
@@ -84,7 +192,7 @@ FAT_FILE * mini_file_create_file(FAT_FILESYSTEM *fs, const char *filename)
 	assert(strlen(filename)< MAX_FILENAME_LENGTH);
 	FAT_FILE *fd = mini_file_create(filename);
 
-	int new_block_index = mini_fat_allocate_new_block(fs, FILE_ENTRY_BLOCK);
+	int new_block_index = mini_fat_allocate_new_block(fs, FILE_ENTRY_BLOCK, -1);
 	if (new_block_index == -1)
 	{
 		fprintf(stderr, "Cannot create new file '%s': filesystem is full.\n", filename);
@@ -102,44 +210,75 @@ FAT_FILE * mini_file_create_file(FAT_FILESYSTEM *fs, const char *filename)
  * @return          file size in bytes, or zero if file does not exist.
  */
 int mini_file_size(FAT_FILESYSTEM *fs, const char *filename) {
+	FAT_LOCK lock(fs); // Keeps the file from being deleted.
+	pthread_mutex_lock(&fs->files_lock);
 	FAT_FILE * fd = mini_file_find(fs, filename);
+	pthread_mutex_unlock(&fs->files_lock);
 	if (!fd) {
 		fprintf(stderr, "File '%s' does not exist.\n", filename);
 		return 0;
 	}
+	FAT_FILE_LOCK file_lock(fd);
 	return fd->size;
 }
 
 
-/**
- * Opens a file in filesystem.
- * If the file does not exist, returns NULL, unless it is write mode, where
- * the file is created.
- * Adds the opened file to file's open handles.
- * @param  is_write whether it is opened in write (append) mode or read.
- * @return FAT_OPEN_FILE pointer on success, NULL on failure
- */
-FAT_OPEN_FILE * mini_file_open(FAT_FILESYSTEM *fs, const char *filename, const bool is_write)
+// mini_file_open, with fs->files_lock held.
+static FAT_OPEN_FILE * mini_file_open_locked(FAT_FILESYSTEM *fs, const char *filename, const bool is_write)
 {
 	FAT_FILE * fd = mini_file_find(fs, filename);
 	if (!fd) {
-		// TODO: check if it's write mode, and if so create it. Otherwise return NULL.
-		return NULL;
+		if (!is_write) {
+			fprintf(stderr, "Cannot open '%s': file does not exist.\n", filename);
+			return NULL;
+		}
+		fd = mini_file_create_file(fs, filename);
+		if (!fd)
+			return NULL;
 	}
 
 	if (is_write) {
-		// TODO: check if other write handles are open.
-		return NULL;
+		for (int i=0; i<(int)fd->open_handles.size(); ++i) {
+			if (fd->open_handles[i]->is_write) {
+				fprintf(stderr, "Cannot open '%s' for writing: file is already open for writing.\n", filename);
+				return NULL;
+			}
+		}
 	}
 
 	FAT_OPEN_FILE * open_file = new FAT_OPEN_FILE;
-	// TODO: assign open_file fields.
+	open_file->file = fd;
+	open_file->is_write = is_write;
+	open_file->position = 0; // Write handles append, see mini_file_open.
 
 	// Add to list of open handles for fd:
 	fd->open_handles.push_back(open_file);
 	return open_file;
 }
 
+/**
+ * Opens a file in filesystem.
+ * If the file does not exist, returns NULL, unless it is write mode, where
+ * the file is created.
+ * Adds the opened file to file's open handles.
+ * @param  is_write whether it is opened in write (append) mode or read.
+ * @return FAT_OPEN_FILE pointer on success, NULL on failure
+ */
+FAT_OPEN_FILE * mini_file_open(FAT_FILESYSTEM *fs, const char *filename, const bool is_write)
+{
+	FAT_LOCK lock(fs);
+	if (is_write && mini_fat_is_read_only(fs))
+		return NULL;
+	pthread_mutex_lock(&fs->files_lock);
+	FAT_OPEN_FILE * open_file = mini_file_open_locked(fs, filename, is_write);
+	pthread_mutex_unlock(&fs->files_lock);
+	if (open_file && is_write) {
+		FAT_FILE_LOCK file_lock(open_file->file);
+		open_file->position = open_file->file->size;
+	}
+	return open_file;
+}
+
 /**
  * Close an existing open file handle.
  * @return false on failure (no open file handle), true on success.
@@ -148,24 +287,274 @@ bool mini_file_close(FAT_FILESYSTEM *fs, const FAT_OPEN_FILE * open_file)
 {
 	if (open_file == NULL) return false;
 	FAT_FILE * fd = open_file->file;
-	if (vector_delete_value(fd->open_handles, open_file)) {
+	pthread_mutex_lock(&fs->files_lock);
+	bool is_open = vector_delete_value(fd->open_handles, open_file);
+	pthread_mutex_unlock(&fs->files_lock);
+	if (is_open)
 		return true;
-	}
 
 	fprintf(stderr, "Attempting to close file that is not open.\n");
 	return false;
 }
 
+/**
+ * Files without data blocks keep their data inline, in the free space of the
+ * entry block right after the name. Returns the number of bytes that fit.
+ */
+int mini_file_inline_capacity(const FAT_FILESYSTEM *fs, const FAT_FILE * fd)
+{
+	int capacity = fs->block_size - ENTRY_HEADER_SIZE - (int)strlen(fd->name);
+	return capacity > 0 ? capacity : 0;
+}
+
+// Offset of the inline data inside the entry block.
+static int mini_file_inline_offset(const FAT_FILE * fd)
+{
+	return ENTRY_HEADER_SIZE + strlen(fd->name);
+}
+
+/**
+ * Find where the byte at position of a file is stored on disk: a data block,
+ * or the entry block for inline files.
+ * @return number of bytes stored contiguously on disk from there on (to the
+ *         end of the run of consecutive blocks), ignoring the file size.
+ */
+static int mini_file_locate(const FAT_FILESYSTEM *fs, const FAT_FILE * fd, const int position, int * block_id, int * byte_index)
+{
+	if (fd->block_ids.empty()) {
+		*block_id = fd->metadata_block_id;
+		*byte_index = mini_file_inline_offset(fd) + position;
+		return mini_file_inline_capacity(fs, fd) - position;
+	}
+
+	int block_index = position_to_block_index(fs, position);
+	*block_id = fd->block_ids[block_index];
+	*byte_index = position_to_byte_index(fs, position);
+	int bytes = fs->block_size - *byte_index;
+	while (block_index + 1 < (int)fd->block_ids.size() && fd->block_ids[block_index+1] == fd->block_ids[block_index] + 1) {
+		bytes += fs->block_size;
+		block_index++;
+	}
+	return bytes;
+}
+
+/**
+ * Move inline data to the first data block, once an inline file got blocks.
+ */
+static void mini_file_move_inline_data(FAT_FILESYSTEM *fs, FAT_FILE * fd)
+{
+	if (fd->size > 0)
+		mini_fat_copy_range(fs, fd->metadata_block_id, mini_file_inline_offset(fd), fd->block_ids[0], 0, fd->size);
+}
+
+/**
+ * Make sure a file has data blocks up to byte position end, allocating all
+ * missing blocks in one contiguous run after the last block when possible.
+ * @return false if the blocks could not be allocated at once.
+ */
+static bool mini_file_reserve(FAT_FILESYSTEM *fs, FAT_FILE * fd, const int end)
+{
+	bool is_inline = fd->block_ids.empty();
+	if (is_inline && end <= mini_file_inline_capacity(fs, fd))
+		return true;
+	int missing = (end + fs->block_size - 1) / fs->block_size - (int)fd->block_ids.size();
+	if (missing <= 0)
+		return true;
+	int hint = is_inline ? fd->metadata_block_id : fd->block_ids.back() + 1;
+	if (!mini_fat_allocate_blocks(fs, missing, FILE_DATA_BLOCK, hint, fd->block_ids))
+		return false;
+	if (is_inline)
+		mini_file_move_inline_data(fs, fd);
+	return true;
+}
+
+/**
+ * Before bytes [position, position + size) of a file are overwritten, give
+ * the blocks holding them that are shared with a snapshot a copy of their
+ * own, and in log-structured mode move the blocks to the log head. Blocks
+ * past the file size hold no data yet and stay where they are.
+ * @return false if shared blocks cannot be copied (the disk is full).
+ */
+static bool mini_file_relocate(FAT_FILESYSTEM *fs, FAT_FILE * fd, const int position, const int size)
+{
+	if (size <= 0 || (!fs->log_structured && fs->snapshots.empty()))
+		return true;
+	std::vector<int*> blocks;
+	std::vector<bool> keep_contents;
+	if (fd->block_ids.empty()) {
+		blocks.push_back(&fd->metadata_block_id);
+		keep_contents.push_back(true);
+	}
+	int first = position_to_block_index(fs, position);
+	int last = position_to_block_index(fs, position + size - 1);
+	for (int i=first; i<=last && i<(int)fd->block_ids.size() && i * fs->block_size < fd->size; ++i) {
+		bool is_covered = position <= i * fs->block_size && position + size >= (i + 1) * fs->block_size;
+		blocks.push_back(&fd->block_ids[i]);
+		keep_contents.push_back(!is_covered);
+	}
+
+	std::vector<int> old_block_ids;
+	bool is_moving = false;
+	for (int i=0; i<(int)blocks.size(); ++i) {
+		old_block_ids.push_back(*blocks[i]);
+		is_moving |= fs->log_structured || fs->snapshot_blocks[*blocks[i]];
+	}
+	if (is_moving && fd->mapped_views > 0) {
+		fprintf(stderr, "Cannot write to '%s': its blocks cannot move while a view of it is mapped.\n", fd->name);
+		return false;
+	}
+	if (!mini_fat_snapshot_unshare(fs, blocks, keep_contents)) {
+		fprintf(stderr, "Cannot write to '%s': no room to copy blocks shared with a snapshot.\n", fd->name);
+		return false;
+	}
+	// Blocks just copied already sit at the log head.
+	for (int i=0; fs->log_structured && i<(int)blocks.size(); ++i) {
+		if (*blocks[i] == old_block_ids[i])
+			*blocks[i] = mini_fat_log_relocate(fs, *blocks[i], keep_contents[i]);
+	}
+	return true;
+}
+
+/**
+ * Reserve data blocks for the first size bytes of a file without writing
+ * them or changing the file size, so that later writes up to size do not
+ * allocate. Blocks are taken as one contiguous run when one is free.
+ * @return false if the file is not open for writing or the disk is full.
+ */
+bool mini_file_preallocate(FAT_FILESYSTEM *fs, FAT_OPEN_FILE * open_file, const int size)
+{
+	FAT_LOCK lock(fs);
+	if (!open_file->is_write) {
+		fprintf(stderr, "Cannot preallocate '%s': file is open for reading.\n", open_file->file->name);
+		return false;
+	}
+	FAT_FILE_LOCK file_lock(open_file->file, true);
+	return mini_file_reserve(fs, open_file->file, size);
+}
+
+static int mini_file_write_locked(FAT_FILESYSTEM *fs, FAT_OPEN_FILE * open_file, const int size, const void * buffer);
+
+/**
+ * Set the size of a file, see mini_file_truncate. The caller holds the disk
+ * lock, and the file lock exclusively unless the disk lock is.
+ */
+static bool mini_file_set_size(FAT_FILESYSTEM *fs, FAT_FILE * fd, const int size)
+{
+	if (size > fd->size) {
+		FAT_OPEN_FILE writer = {fd, fd->size, true};
+		std::vector<char> zeros(fs->block_size, 0);
+		while (writer.position < size) {
+			int chunk = size - writer.position < fs->block_size ? size - writer.position : fs->block_size;
+			if (mini_file_write_locked(fs, &writer, chunk, &zeros[0]) < chunk)
+				break;
+		}
+		return fd->size == size;
+	}
+
+	int keep = size == 0 ? 0 : (size + fs->block_size - 1) / fs->block_size;
+	if (keep < (int)fd->block_ids.size()) {
+		std::vector<int> freed(fd->block_ids.begin() + keep, fd->block_ids.end());
+		fd->block_ids.resize(keep);
+		mini_fat_free_blocks(fs, freed);
+	}
+	fd->size = size;
+	pthread_mutex_lock(&fs->files_lock);
+	for (int i=0; i<(int)fd->open_handles.size(); ++i) {
+		FAT_OPEN_FILE * handle = const_cast<FAT_OPEN_FILE *>(fd->open_handles[i]);
+		if (handle->position > size)
+			handle->position = size;
+	}
+	pthread_mutex_unlock(&fs->files_lock);
+	return true;
+}
+
+/**
+ * Set the size of a file. Shrinking frees the data blocks past the new end
+ * (including preallocated ones), truncating to zero frees all of them.
+ * Growing fills the new bytes with zeros. Positions of other handles past
+ * the new end are moved to it.
+ * @return false if the file is not open for writing or the disk is full.
+ */
+bool mini_file_truncate(FAT_FILESYSTEM *fs, FAT_OPEN_FILE * open_file, const int size)
+{
+	FAT_LOCK lock(fs);
+	if (!open_file->is_write || size < 0) {
+		fprintf(stderr, "Cannot truncate '%s': file is not open for writing.\n", open_file->file->name);
+		return false;
+	}
+	FAT_FILE_LOCK file_lock(open_file->file, true);
+	return mini_file_set_size(fs, open_file->file, size);
+}
+
 /**
  * Write size bytes from buffer to open_file, at current position.
  * @return           number of bytes written.
  */
 int mini_file_write(FAT_FILESYSTEM *fs, FAT_OPEN_FILE * open_file, const int size, const void * buffer)
+{
+	FAT_LOCK lock(fs);
+	FAT_FILE_LOCK file_lock(open_file->file, true);
+	return mini_file_write_locked(fs, open_file, size, buffer);
+}
+
+// mini_file_write, for callers holding the disk lock, and the file lock
+// exclusively unless the disk lock is.
+static int mini_file_write_locked(FAT_FILESYSTEM *fs, FAT_OPEN_FILE * open_file, const int size, const void * buffer)
 {
 	int written_bytes = 0;
+	FAT_FILE * fd = open_file->file;
+	if (!open_file->is_write) {
+		fprintf(stderr, "Cannot write to '%s': file is open for reading.\n", fd->name);
+		return 0;
+	}
+
+	if (size <= 0)
+		return 0;
+
+	if (!mini_file_relocate(fs, fd, open_file->position, size))
+		return 0;
+	if (fd->block_ids.empty() && open_file->position + size <= mini_file_inline_capacity(fs, fd)) {
+		// Still small enough to stay in the entry block.
+		written_bytes = mini_fat_write_in_block(fs, fd->metadata_block_id, mini_file_inline_offset(fd) + open_file->position, size, buffer);
+		open_file->position += written_bytes;
+		if (open_file->position > fd->size)
+			fd->size = open_file->position;
+		return written_bytes;
+	}
 
-	// TODO: write to file.
+	// Allocate every block of the write up front; if that fails, the loop
+	// below still allocates block by block until the disk is full.
+	mini_file_reserve(fs, fd, open_file->position + size);
 
+	// Collect the pieces of every block first, so they go to disk as a
+	// few large (and on striped disks, parallel) writes.
+	const char * data = (const char *)buffer;
+	std::vector<FAT_BLOCK_IO> ios;
+	for (int planned = 0; planned < size; ) {
+		int block_index = position_to_block_index(fs, open_file->position + planned);
+		int byte_index = position_to_byte_index(fs, open_file->position + planned);
+		if (block_index == (int)fd->block_ids.size()) {
+			int hint = block_index == 0 ? fd->metadata_block_id : fd->block_ids.back() + 1;
+			int new_block_index = mini_fat_allocate_new_block(fs, FILE_DATA_BLOCK, hint);
+			if (new_block_index == -1)
+				break;
+			fd->block_ids.push_back(new_block_index);
+			if (block_index == 0)
+				mini_file_move_inline_data(fs, fd);
+		}
+
+		int chunk = fs->block_size - byte_index;
+		if (chunk > size - planned)
+			chunk = size - planned;
+		FAT_BLOCK_IO io = {fd->block_ids[block_index], byte_index, chunk, (char *)data + planned, 0};
+		ios.push_back(io);
+		planned += chunk;
+	}
+	written_bytes = mini_fat_transfer_blocks(fs, ios, true);
+	open_file->position += written_bytes;
+
+	if (open_file->position > fd->size)
+		fd->size = open_file->position;
 	return written_bytes;
 }
 
@@ -175,14 +564,288 @@ int mini_file_write(FAT_FILESYSTEM *fs, FAT_OPEN_FILE * open_file, const int siz
  */
 int mini_file_read(FAT_FILESYSTEM *fs, FAT_OPEN_FILE * open_file, const int size, void * buffer)
 {
+	FAT_LOCK lock(fs);
 	int read_bytes = 0;
+	FAT_FILE * fd = open_file->file;
+	FAT_FILE_LOCK file_lock(fd);
+
+	char * data = (char *)buffer;
+	int available = fd->size - open_file->position;
+	if (available > size)
+		available = size;
+	std::vector<FAT_BLOCK_IO> ios;
+	for (int planned = 0; planned < available; ) {
+		int block_id, byte_index;
+		mini_file_locate(fs, fd, open_file->position + planned, &block_id, &byte_index);
 
-	// TODO: read file.
+		int chunk = fs->block_size - byte_index;
+		if (chunk > available - planned)
+			chunk = available - planned;
+		FAT_BLOCK_IO io = {block_id, byte_index, chunk, data + planned, 0};
+		ios.push_back(io);
+		planned += chunk;
+	}
+	read_bytes = mini_fat_transfer_blocks(fs, ios, false);
+	open_file->position += read_bytes;
 
 	return read_bytes;
 }
 
 
+/**
+ * Copy up to size bytes from the position of source to the position of
+ * destination inside the disk, advancing both. Each run of consecutive
+ * blocks is copied by the kernel, without passing through a user buffer.
+ * Source and destination must be different files.
+ * @return number of bytes copied.
+ */
+int mini_file_copy(FAT_FILESYSTEM *fs, FAT_OPEN_FILE * source, FAT_OPEN_FILE * destination, const int size)
+{
+	FAT_LOCK lock(fs);
+	FAT_FILE * src = source->file;
+	FAT_FILE * dst = destination->file;
+	if (!destination->is_write || src == dst) {
+		fprintf(stderr, "Cannot copy '%s' to '%s': destination must be another file open for writing.\n", src->name, dst->name);
+		return 0;
+	}
+	// Locked in address order, so copies in both directions cannot deadlock.
+	FAT_FILE_LOCK first_lock(src < dst ? src : dst, src > dst);
+	FAT_FILE_LOCK second_lock(src < dst ? dst : src, src < dst);
+	int copy_size = size < src->size - source->position ? size : src->size - source->position;
+	if (copy_size <= 0)
+		return 0;
+	if (!mini_file_reserve(fs, dst, destination->position + copy_size))
+		return 0;
+	if (!mini_file_relocate(fs, dst, destination->position, copy_size))
+		return 0;
+
+	int copied_bytes = 0;
+	while (copied_bytes < copy_size) {
+		int src_block, src_byte, dst_block, dst_byte;
+		int chunk = copy_size - copied_bytes;
+		int src_run = mini_file_locate(fs, src, source->position, &src_block, &src_byte);
+		int dst_run = mini_file_locate(fs, dst, destination->position, &dst_block, &dst_byte);
+		if (chunk > src_run)
+			chunk = src_run;
+		if (chunk > dst_run)
+			chunk = dst_run;
+
+		int copied = mini_fat_copy_range(fs, src_block, src_byte, dst_block, dst_byte, chunk);
+		copied_bytes += copied;
+		source->position += copied;
+		destination->position += copied;
+		if (copied < chunk)
+			break;
+	}
+
+	if (destination->position > dst->size)
+		dst->size = destination->position;
+	return copied_bytes;
+}
+
+/**
+ * Copy up to size bytes from the position of source to a host file
+ * descriptor (at its own offset), advancing the file position.
+ * @return number of bytes copied.
+ */
+int mini_file_copy_to_fd(FAT_FILESYSTEM *fs, FAT_OPEN_FILE * source, const int host_fd, const int size)
+{
+	FAT_LOCK lock(fs);
+	FAT_FILE * src = source->file;
+	FAT_FILE_LOCK file_lock(src);
+	int copy_size = size < src->size - source->position ? size : src->size - source->position;
+
+	int copied_bytes = 0;
+	while (copied_bytes < copy_size) {
+		int block_id, byte_index;
+		int chunk = copy_size - copied_bytes;
+		int run = mini_file_locate(fs, src, source->position, &block_id, &byte_index);
+		if (chunk > run)
+			chunk = run;
+
+		int copied = mini_fat_copy_to_fd(fs, block_id, byte_index, chunk, host_fd);
+		copied_bytes += copied;
+		source->position += copied;
+		if (copied < chunk)
+			break;
+	}
+	return copied_bytes;
+}
+
+/**
+ * Copy up to size bytes from a host file descriptor (at its own offset) to
+ * the position of destination, advancing the file position. Stops early at
+ * the end of the host input; blocks reserved past the bytes copied (other
+ * than preallocated ones) are freed again.
+ * @return number of bytes copied.
+ */
+int mini_file_copy_from_fd(FAT_FILESYSTEM *fs, FAT_OPEN_FILE * destination, const int host_fd, const int size)
+{
+	FAT_LOCK lock(fs);
+	FAT_FILE * dst = destination->file;
+	if (!destination->is_write) {
+		fprintf(stderr, "Cannot copy to '%s': file is open for reading.\n", dst->name);
+		return 0;
+	}
+	FAT_FILE_LOCK file_lock(dst, true);
+	if (size <= 0)
+		return 0;
+	if (size > INT_MAX - destination->position) {
+		fprintf(stderr, "Cannot copy to '%s': file would be too large.\n", dst->name);
+		return 0;
+	}
+	int old_block_count = dst->block_ids.size();
+
+	int copied_bytes = 0;
+	bool is_done = false, is_nearly_full = false;
+	while (!is_done && copied_bytes < size) {
+		int window = size - copied_bytes;
+		if (window > COPY_RESERVE_BLOCKS * fs->block_size)
+			window = COPY_RESERVE_BLOCKS * fs->block_size;
+		if (is_nearly_full || !mini_file_reserve(fs, dst, destination->position + window)) {
+			// Go on a block at a time, like mini_file_write.
+			is_nearly_full = true;
+			int block_end = (position_to_block_index(fs, destination->position) + 1) * fs->block_size;
+			if (window > block_end - destination->position)
+				window = block_end - destination->position;
+			if (!mini_file_reserve(fs, dst, destination->position + window))
+				break;
+		}
+		if (!mini_file_relocate(fs, dst, destination->position, window))
+			break;
+
+		for (int window_copied = 0; window_copied < window; ) {
+			int block_id, byte_index;
+			int chunk = window - window_copied;
+			int run = mini_file_locate(fs, dst, destination->position, &block_id, &byte_index);
+			if (chunk > run)
+				chunk = run;
+
+			int copied = mini_fat_copy_from_fd(fs, host_fd, block_id, byte_index, chunk);
+			window_copied += copied;
+			copied_bytes += copied;
+			destination->position += copied;
+			if (copied < chunk) {
+				is_done = true;
+				break;
+			}
+		}
+	}
+
+	if (destination->position > dst->size)
+		dst->size = destination->position;
+	int keep = (dst->size + fs->block_size - 1) / fs->block_size;
+	if (keep < old_block_count)
+		keep = old_block_count;
+	if (keep < (int)dst->block_ids.size()) {
+		std::vector<int> unused(dst->block_ids.begin() + keep, dst->block_ids.end());
+		dst->block_ids.resize(keep);
+		mini_fat_free_blocks(fs, unused);
+	}
+	return copied_bytes;
+}
+
+/**
+ * Map size bytes of an open file, starting at offset, for in-place reading.
+ * If the range lies in consecutive blocks the view points directly into the
+ * disk mapping. Otherwise, when blocks are page aligned, the blocks are
+ * stitched into one read-only mapping, and only as a last resort is the range
+ * copied. The view must be released with mini_file_unmap. Views of shared
+ * mappings reflect later writes to the blocks they map. Until they are
+ * released, the blocks of the file stay put: writes that would move them
+ * (log-structured mode, copy-on-write of snapshot blocks) fail, and so do
+ * mini_fat_resize, mini_fat_set_direct_io and deleting the file; the log
+ * cleaner skips segments holding them. Blocks freed by shrinking the file
+ * are not protected.
+ * @return view on success, NULL if the range is not inside the file.
+ */
+FAT_FILE_VIEW * mini_file_map(FAT_FILESYSTEM *fs, FAT_OPEN_FILE * open_file, const int offset, const int size)
+{
+	FAT_LOCK lock(fs);
+	FAT_FILE * fd = open_file->file;
+	FAT_FILE_LOCK file_lock(fd);
+	if (offset < 0 || size <= 0 || offset + size > fd->size) {
+		fprintf(stderr, "Cannot map '%s': range is outside of the file.\n", fd->name);
+		return NULL;
+	}
+
+	int block_id, byte_index;
+	bool is_contiguous = mini_file_locate(fs, fd, offset, &block_id, &byte_index) >= size;
+	int first_block = position_to_block_index(fs, offset);
+	int last_block = position_to_block_index(fs, offset + size - 1);
+
+	FAT_FILE_VIEW * view = new FAT_FILE_VIEW;
+	view->size = size;
+	view->region = NULL;
+	view->region_size = 0;
+	view->is_copy = false;
+	view->file = NULL;
+	view->is_direct = fs->map && is_contiguous;
+	if (view->is_direct) {
+		view->data = (const char *)fs->map + (size_t)block_id * fs->block_size + byte_index;
+		view->file = fd;
+		__sync_fetch_and_add(&fd->mapped_views, 1);
+		return view;
+	}
+
+	// Stitch the blocks next to each other in a fresh address range.
+	size_t region_size = (size_t)(last_block - first_block + 1) * fs->block_size;
+	if (fs->map && !is_contiguous && fs->block_size % sysconf(_SC_PAGESIZE) == 0) {
+		void * region = mmap(NULL, region_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		bool is_mapped = region != MAP_FAILED;
+		for (int i=first_block; is_mapped && i<=last_block; ) {
+			int run = 1;
+			while (i + run <= last_block && fd->block_ids[i+run] == fd->block_ids[i] + run)
+				run++;
+			char * target = (char *)region + (size_t)(i - first_block) * fs->block_size;
+			is_mapped = mmap(target, (size_t)run * fs->block_size, PROT_READ, MAP_SHARED | MAP_FIXED,
+				fs->fd, (off_t)fd->block_ids[i] * fs->block_size) != MAP_FAILED;
+			i += run;
+		}
+		if (is_mapped) {
+			view->region = region;
+			view->region_size = region_size;
+			view->data = (const char *)region + byte_index;
+			view->file = fd;
+			__sync_fetch_and_add(&fd->mapped_views, 1);
+			return view;
+		}
+		if (region != MAP_FAILED)
+			munmap(region, region_size);
+	}
+
+	char * copy = new char[size];
+	int read_bytes = 0;
+	while (read_bytes < size) {
+		mini_file_locate(fs, fd, offset + read_bytes, &block_id, &byte_index);
+		int chunk = fs->block_size - byte_index;
+		if (chunk > size - read_bytes)
+			chunk = size - read_bytes;
+		mini_fat_read_in_block(fs, block_id, byte_index, chunk, copy + read_bytes);
+		read_bytes += chunk;
+	}
+	view->region = copy;
+	view->region_size = size;
+	view->is_copy = true;
+	view->data = copy;
+	return view;
+}
+
+/**
+ * Release a view returned by mini_file_map.
+ */
+void mini_file_unmap(FAT_FILE_VIEW * view)
+{
+	if (view == NULL) return;
+	if (view->file)
+		__sync_fetch_and_sub(&view->file->mapped_views, 1);
+	if (view->is_copy)
+		delete[] (char *)view->region;
+	else if (view->region)
+		munmap(view->region, view->region_size);
+	delete view;
+}
+
 /**
  * Change the cursor position of an open file.
  * @param  offset     how much to change
@@ -191,9 +854,14 @@ int mini_file_read(FAT_FILESYSTEM *fs, FAT_OPEN_FILE * open_file, const int size
  */
 bool mini_file_seek(FAT_FILESYSTEM *fs, FAT_OPEN_FILE * open_file, const int offset, const bool from_start)
 {
-	// TODO: seek and return true.
+	FAT_LOCK lock(fs);
+	FAT_FILE_LOCK file_lock(open_file->file);
+	int position = from_start ? offset : open_file->position + offset;
+	if (position < 0 || position > open_file->file->size)
+		return false;
 
-	return false;
+	open_file->position = position;
+	return true;
 }
 
 /**
@@ -204,7 +872,162 @@ bool mini_file_seek(FAT_FILESYSTEM *fs, FAT_OPEN_FILE * open_file, const int off
  */
 bool mini_file_delete(FAT_FILESYSTEM *fs, const char *filename)
 {
-	// TODO: delete file after checks.
+	FAT_LOCK lock(fs, true); // Nobody may still be looking at the file.
+	if (mini_fat_is_read_only(fs))
+		return false;
+	pthread_mutex_lock(&fs->files_lock);
+	FAT_FILE * fd = mini_file_find(fs, filename);
+	if (!fd) {
+		pthread_mutex_unlock(&fs->files_lock);
+		fprintf(stderr, "Cannot delete '%s': file does not exist.\n", filename);
+		return false;
+	}
+	if (!fd->open_handles.empty() || fd->mapped_views > 0) {
+		pthread_mutex_unlock(&fs->files_lock);
+		fprintf(stderr, "Cannot delete '%s': file is open.\n", filename);
+		return false;
+	}
+	vector_delete_value(fs->files, fd);
+	pthread_mutex_unlock(&fs->files_lock);
 
-	return false;
-}
\ No newline at end of file
+	std::vector<int> blocks = fd->block_ids;
+	blocks.push_back(fd->metadata_block_id);
+	mini_fat_free_blocks(fs, blocks);
+	delete fd;
+	return true;
+}
+/**
+ * Rename a file, see mini_file_batch. Inline data follows the name in the
+ * entry block, so it moves with it, to a data block if it no longer fits.
+ * @return false if the new name is taken or does not fit.
+ */
+static bool mini_file_rename_locked(FAT_FILESYSTEM *fs, FAT_FILE * fd, const char * new_name)
+{
+	if (strlen(new_name) >= (size_t)MAX_FILENAME_LENGTH || mini_file_find(fs, new_name)) {
+		fprintf(stderr, "Cannot rename '%s' to '%s': name is taken or too long.\n", fd->name, new_name);
+		return false;
+	}
+
+	bool is_inline = fd->block_ids.empty() && fd->size > 0;
+	std::vector<char> data(is_inline ? fd->size : 0);
+	if (is_inline && mini_fat_read_in_block(fs, fd->metadata_block_id, mini_file_inline_offset(fd), fd->size, &data[0]) != fd->size)
+		return false;
+
+	char old_name[MAX_FILENAME_LENGTH];
+	strcpy(old_name, fd->name);
+	strcpy(fd->name, new_name);
+	std::vector<char> entry(fs->block_size);
+	if (mini_file_encode_entry(fs, fd, &entry[0]) < 0) {
+		strcpy(fd->name, old_name);
+		return false;
+	}
+	if (!is_inline)
+		return true;
+
+	if (fd->size <= mini_file_inline_capacity(fs, fd)) {
+		std::vector<int*> entry_block(1, &fd->metadata_block_id);
+		if (!mini_fat_snapshot_unshare(fs, entry_block, std::vector<bool>(1, false))) {
+			strcpy(fd->name, old_name);
+			return false;
+		}
+		return mini_fat_write_in_block(fs, fd->metadata_block_id, mini_file_inline_offset(fd), fd->size, &data[0]) == fd->size;
+	}
+	int block_id = mini_fat_allocate_new_block(fs, FILE_DATA_BLOCK, fd->metadata_block_id);
+	if (block_id == -1) {
+		strcpy(fd->name, old_name);
+		return false;
+	}
+	fd->block_ids.push_back(block_id);
+	return mini_fat_write_in_block(fs, block_id, 0, fd->size, &data[0]) == fd->size;
+}
+
+static bool mini_file_entry_order(const FAT_FILE * a, const FAT_FILE * b)
+{
+	return a->metadata_block_id < b->metadata_block_id;
+}
+
+/**
+ * Apply many metadata operations at once: create (an empty file), delete,
+ * rename and set-size (as mini_file_truncate, without an open handle).
+ * The disk lock is taken once, the entry blocks of all creates are
+ * allocated together, as one run when possible, and the block map and the
+ * changed entries are persisted with a single metadata write at the end,
+ * so no mini_fat_save is needed afterwards. Operations apply in order; one
+ * that fails is reported and skipped, leaving its is_done false.
+ * @return number of operations done, or -1 if the metadata write failed:
+ *         the operations are then only done in memory, until a
+ *         mini_fat_save succeeds.
+ */
+int mini_file_batch(FAT_FILESYSTEM *fs, std::vector<FAT_BATCH_OP> &ops)
+{
+	FAT_LOCK lock(fs, true);
+	if (mini_fat_is_read_only(fs))
+		return 0;
+	pthread_mutex_lock(&fs->files_lock);
+
+	int creates = 0;
+	for (int i=0; i<(int)ops.size(); ++i) {
+		creates += ops[i].type == FAT_BATCH_CREATE;
+	}
+	std::vector<int> entry_blocks;
+	if (creates > 1)
+		mini_fat_allocate_blocks(fs, creates, FILE_ENTRY_BLOCK, -1, entry_blocks);
+	int next_entry = 0;
+
+	int done = 0;
+	std::vector<FAT_FILE *> changed;
+	for (int i=0; i<(int)ops.size(); ++i) {
+		FAT_BATCH_OP &op = ops[i];
+		FAT_FILE * fd = mini_file_find(fs, op.name);
+		op.is_done = false;
+		if (op.type == FAT_BATCH_CREATE) {
+			if (fd || strlen(op.name) >= (size_t)MAX_FILENAME_LENGTH) {
+				fprintf(stderr, "Cannot create '%s': file exists or name is too long.\n", op.name);
+				continue;
+			}
+			int block_id = next_entry < (int)entry_blocks.size() ? entry_blocks[next_entry++] : mini_fat_allocate_new_block(fs, FILE_ENTRY_BLOCK, -1);
+			if (block_id == -1) {
+				fprintf(stderr, "Cannot create new file '%s': filesystem is full.\n", op.name);
+				continue;
+			}
+			fd = mini_file_create(op.name);
+			fd->metadata_block_id = block_id;
+			fs->files.push_back(fd);
+			op.is_done = true;
+		} else if (!fd) {
+			fprintf(stderr, "Cannot change '%s': file does not exist.\n", op.name);
+			continue;
+		} else if (op.type == FAT_BATCH_DELETE) {
+			if (!fd->open_handles.empty() || fd->mapped_views > 0) {
+				fprintf(stderr, "Cannot delete '%s': file is open.\n", op.name);
+				continue;
+			}
+			std::vector<int> blocks = fd->block_ids;
+			blocks.push_back(fd->metadata_block_id);
+			mini_fat_free_blocks(fs, blocks);
+			vector_delete_value(fs->files, fd);
+			changed.erase(std::remove(changed.begin(), changed.end(), fd), changed.end());
+			delete fd;
+			done++;
+			op.is_done = true;
+			continue;
+		} else if (op.type == FAT_BATCH_RENAME) {
+			op.is_done = mini_file_rename_locked(fs, fd, op.new_name);
+		} else if (op.type == FAT_BATCH_SET_SIZE) {
+			op.is_done = op.size >= 0 && mini_file_set_size(fs, fd, op.size);
+		}
+		if (op.is_done) {
+			changed.push_back(fd);
+			done++;
+		}
+	}
+	mini_fat_free_blocks(fs, std::vector<int>(entry_blocks.begin() + next_entry, entry_blocks.end()));
+
+	// In block order, so consecutive entries are written together.
+	std::sort(changed.begin(), changed.end());
+	changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+	std::sort(changed.begin(), changed.end(), mini_file_entry_order);
+	bool is_saved = mini_fat_write_metadata(fs, changed);
+	pthread_mutex_unlock(&fs->files_lock);
+	return is_saved ? done : -1;
+}
@@ -3,6 +3,7 @@
 
 
 #include <vector>
+#include <pthread.h>
 
 const int MAX_FILENAME_LENGTH = 256;
 
@@ -21,10 +22,56 @@ typedef struct t_FAT_FILE {
 	std::vector<int> block_ids; // Data blocks.
 
 	std::vector<const FAT_OPEN_FILE*> open_handles; // One entry each time this file is opened.
+	int mapped_views; // Open views into the disk mapping; while any is open, blocks of the file do not move.
+
+	// Shared for reads, maps and the size; exclusive for anything that changes
+	// block_ids or size. Taken after the disk lock, and not needed by callers
+	// holding that one exclusively.
+	pthread_rwlock_t lock;
+
+	t_FAT_FILE() : mapped_views(0) { pthread_rwlock_init(&lock, NULL); }
+	~t_FAT_FILE() { pthread_rwlock_destroy(&lock); }
 } FAT_FILE;
 
+// Holds the lock of a file (shared or exclusive) for the lifetime of the object.
+struct FAT_FILE_LOCK {
+	FAT_FILE * file;
+	FAT_FILE_LOCK(FAT_FILE * file, const bool is_exclusive = false) : file(file) {
+		if (is_exclusive)
+			pthread_rwlock_wrlock(&file->lock);
+		else
+			pthread_rwlock_rdlock(&file->lock);
+	}
+	~FAT_FILE_LOCK() { pthread_rwlock_unlock(&file->lock); }
+};
+
 typedef struct t_FAT_FILESYSTEM FAT_FILESYSTEM; // Forward definition.
 
+// Metadata operations of mini_file_batch.
+const int FAT_BATCH_CREATE = 0;
+const int FAT_BATCH_DELETE = 1;
+const int FAT_BATCH_RENAME = 2;
+const int FAT_BATCH_SET_SIZE = 3;
+
+typedef struct t_FAT_BATCH_OP {
+	int type;
+	const char * name;
+	const char * new_name; // FAT_BATCH_RENAME only.
+	int size; // FAT_BATCH_SET_SIZE only.
+	bool is_done; // Set by mini_file_batch.
+} FAT_BATCH_OP;
+
+// Read-only view of a byte range of a file, returned by mini_file_map.
+typedef struct t_FAT_FILE_VIEW {
+	const char * data; // First byte of the requested range.
+	int size;
+	bool is_direct; // Data points straight into the disk mapping (range is contiguous on disk).
+	void * region; // Stitched mapping or copy owned by the view, NULL if direct.
+	size_t region_size;
+	bool is_copy; // Region was allocated with new[], otherwise it is a mapping.
+	FAT_FILE * file; // File whose mapped_views counts this view, NULL for copies.
+} FAT_FILE_VIEW;
+
 
 /// Public APIs
 // DO NOT MODIFY THE FOLLOWING:
@@ -39,11 +86,27 @@ int mini_file_size(FAT_FILESYSTEM *fs, const char *filename);
 int mini_file_read(FAT_FILESYSTEM *fs, FAT_OPEN_FILE * open_file, const int size, void * buffer);
 int mini_file_write(FAT_FILESYSTEM *fs, FAT_OPEN_FILE * open_file, const int size, const void * buffer);
 
+int mini_file_copy(FAT_FILESYSTEM *fs, FAT_OPEN_FILE * source, FAT_OPEN_FILE * destination, const int size);
+int mini_file_copy_to_fd(FAT_FILESYSTEM *fs, FAT_OPEN_FILE * source, const int host_fd, const int size);
+int mini_file_copy_from_fd(FAT_FILESYSTEM *fs, FAT_OPEN_FILE * destination, const int host_fd, const int size);
+
+bool mini_file_truncate(FAT_FILESYSTEM *fs, FAT_OPEN_FILE * open_file, const int size);
+bool mini_file_preallocate(FAT_FILESYSTEM *fs, FAT_OPEN_FILE * open_file, const int size);
+
+FAT_FILE_VIEW * mini_file_map(FAT_FILESYSTEM *fs, FAT_OPEN_FILE * open_file, const int offset, const int size);
+void mini_file_unmap(FAT_FILE_VIEW * view);
+
+int mini_file_batch(FAT_FILESYSTEM *fs, std::vector<FAT_BATCH_OP> &ops);
+
 
 // Helpers (not mandatory):
 FAT_FILE * mini_file_create_file(FAT_FILESYSTEM *fs, const char *filename);
 FAT_FILE * mini_file_create(const char * filename);
 FAT_FILE * mini_file_find(const FAT_FILESYSTEM *fs, const char *filename);
+int mini_file_inline_capacity(const FAT_FILESYSTEM *fs, const FAT_FILE * fd);
+int mini_file_encode_entry(const FAT_FILESYSTEM *fs, const FAT_FILE *file, char * entry);
+bool mini_file_save_entry(FAT_FILESYSTEM *fs, const FAT_FILE *file);
+FAT_FILE * mini_file_load_entry(FAT_FILESYSTEM *fs, const int block_id);
 
 inline int position_to_block_index(const FAT_FILESYSTEM * fs, const int position)  {
 	return position / fs->block_size;
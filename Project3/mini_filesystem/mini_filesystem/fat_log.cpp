@@ -0,0 +1,281 @@
+#include <stdio.h>
+#include <assert.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <vector>
+
+#include "fat.h"
+#include "fat_file.h"
+
+// The background cleaner keeps at least this many segments clean.
+const int FAT_CLEANER_MIN_CLEAN_SEGMENTS = 2;
+// Segments with more live blocks than this fraction are not worth cleaning.
+const int FAT_CLEANER_MAX_LIVE_PERCENT = 75;
+// How often the background cleaner checks the disk without being woken up.
+const int FAT_CLEANER_PERIOD_MS = 100;
+
+static int mini_fat_log_segment_count(const FAT_FILESYSTEM *fs) {
+	return (fs->block_count + fs->segment_blocks - 1) / fs->segment_blocks;
+}
+
+// First block of the segment and one past its last block.
+static void mini_fat_log_segment_range(const FAT_FILESYSTEM *fs, const int segment, int * first, int * end) {
+	*first = segment * fs->segment_blocks;
+	*end = *first + fs->segment_blocks < fs->block_count ? *first + fs->segment_blocks : fs->block_count;
+}
+
+// With pending set, blocks waiting for the next checkpoint count as free.
+static bool mini_fat_log_is_clean(const FAT_FILESYSTEM *fs, const int segment, const std::vector<bool> * pending = NULL) {
+	int first, end;
+	mini_fat_log_segment_range(fs, segment, &first, &end);
+	for (int i=first; i<end; ++i) {
+		if (fs->block_map[i] != EMPTY_BLOCK && !(pending && (*pending)[i]))
+			return false;
+	}
+	return true;
+}
+
+// Segments that are clean, or will be once the pending blocks are freed.
+static int mini_fat_log_clean_count(const FAT_FILESYSTEM *fs, const std::vector<bool> &pending) {
+	int clean = 0;
+	for (int i=0; i<mini_fat_log_segment_count(fs); ++i) {
+		clean += mini_fat_log_is_clean(fs, i, &pending);
+	}
+	return clean;
+}
+
+// Blocks of log_pending_free, by block index. The caller holds the disk lock exclusively.
+static std::vector<bool> mini_fat_log_pending_map(const FAT_FILESYSTEM *fs) {
+	std::vector<bool> pending(fs->block_count, false);
+	for (int i=0; i<(int)fs->log_pending_free.size(); ++i) {
+		pending[fs->log_pending_free[i]] = true;
+	}
+	return pending;
+}
+
+/**
+ * Pick the next block at the log head, without marking it. The head fills
+ * its segment, then jumps to the next clean segment. When no clean segment
+ * is left, the holes of other segments are filled in disk order.
+ * @param  avoid_segment segment not to allocate from (being cleaned), or -1
+ * @return block index, or -1 if the disk is full.
+ */
+int mini_fat_log_next_block(FAT_FILESYSTEM *fs, const int avoid_segment) {
+	int head = fs->log_head;
+	if (head > 0 && head < fs->block_count && head % fs->segment_blocks != 0 && head / fs->segment_blocks != avoid_segment) {
+		int first, end;
+		mini_fat_log_segment_range(fs, head / fs->segment_blocks, &first, &end);
+		for (int i=head; i<end; ++i) {
+			if (fs->block_map[i] == EMPTY_BLOCK) {
+				fs->log_head = i + 1;
+				return i;
+			}
+		}
+	}
+
+	pthread_cond_signal(&fs->cleaner_wakeup); // The head moves on, check whether cleaning is needed.
+	int segments = mini_fat_log_segment_count(fs);
+	int current = head >= 0 && head < fs->block_count ? (head - 1) / fs->segment_blocks : -1;
+	for (int i=1; i<=segments; ++i) {
+		int segment = (current + i + segments) % segments;
+		if (segment != avoid_segment && mini_fat_log_is_clean(fs, segment)) {
+			fs->log_head = segment * fs->segment_blocks + 1;
+			return segment * fs->segment_blocks;
+		}
+	}
+
+	for (int i=0; i<fs->block_count; ++i) {
+		if (fs->block_map[i] == EMPTY_BLOCK && i / fs->segment_blocks != avoid_segment) {
+			fs->log_head = i + 1;
+			return i;
+		}
+	}
+	return -1;
+}
+
+/**
+ * Before a block is overwritten in log-structured mode, move it to the log
+ * head, so the write lands at the head instead. The old copy is freed at the
+ * next checkpoint, as the entry on disk still points to it until then.
+ * @param  keep_contents copy the old contents, for partial overwrites
+ * @return the block to write to: the new block, or block_id itself when not
+ *         in log-structured mode or when the disk is full.
+ */
+int mini_fat_log_relocate(FAT_FILESYSTEM *fs, const int block_id, const bool keep_contents) {
+	if (!fs->log_structured)
+		return block_id;
+	pthread_mutex_lock(&fs->log_lock);
+	int new_block_id = mini_fat_log_next_block(fs, -1);
+	if (new_block_id != -1) {
+		fs->block_map[new_block_id] = fs->block_map[block_id];
+		fs->log_pending_free.push_back(block_id);
+	}
+	pthread_mutex_unlock(&fs->log_lock);
+	if (new_block_id == -1)
+		return block_id; // Overwrite in place rather than fail.
+	if (keep_contents)
+		mini_fat_copy_range(fs, block_id, 0, new_block_id, 0, fs->block_size);
+	return new_block_id;
+}
+
+/**
+ * Clean one segment: move its live blocks to the log head. The segment is
+ * free once the next checkpoint writes the entries pointing to the new
+ * blocks; until then a crash finds every file as it was saved.
+ * @return false if the blocks could not all be moved.
+ */
+static bool mini_fat_log_clean_segment(FAT_FILESYSTEM *fs, const int segment, std::vector<bool> &pending) {
+	// Owner of every block: file, and index in block_ids or -1 for the entry.
+	std::vector<FAT_FILE *> owners(fs->block_count, (FAT_FILE *)NULL);
+	std::vector<int> indexes(fs->block_count, -1);
+	for (int i=0; i<(int)fs->files.size(); ++i) {
+		FAT_FILE * file = fs->files[i];
+		owners[file->metadata_block_id] = file;
+		for (int j=0; j<(int)file->block_ids.size(); ++j) {
+			owners[file->block_ids[j]] = file;
+			indexes[file->block_ids[j]] = j;
+		}
+	}
+
+	int first, end;
+	mini_fat_log_segment_range(fs, segment, &first, &end);
+	bool is_complete = true;
+	for (int i=first; i<end; ++i) {
+		if (fs->block_map[i] == EMPTY_BLOCK || pending[i])
+			continue;
+		int new_block_id = owners[i] ? mini_fat_log_next_block(fs, segment) : -1;
+		if (new_block_id == -1) {
+			is_complete = false;
+			break;
+		}
+		fs->block_map[new_block_id] = fs->block_map[i];
+		mini_fat_copy_range(fs, i, 0, new_block_id, 0, fs->block_size);
+		if (indexes[i] == -1)
+			owners[i]->metadata_block_id = new_block_id;
+		else
+			owners[i]->block_ids[indexes[i]] = new_block_id;
+		fs->log_pending_free.push_back(i);
+		pending[i] = true;
+	}
+	return is_complete;
+}
+
+/**
+ * Clean segments until clean_segments segments are completely free, taking
+ * the segments with the fewest live blocks first. Segments holding disk
+ * metadata, snapshot blocks, blocks of files with mapped views or the log
+ * head, and segments that are mostly live, are left alone. Moved blocks reach the disk metadata at the next
+ * mini_fat_save, which also frees the cleaned segments.
+ * @return number of segments cleaned.
+ */
+int mini_fat_log_clean(FAT_FILESYSTEM *fs, const int clean_segments) {
+	FAT_LOCK lock(fs, true);
+	if (!fs->log_structured)
+		return 0;
+
+	std::vector<bool> pending = mini_fat_log_pending_map(fs);
+	std::vector<bool> mapped(fs->block_count, false); // Blocks of files with mapped views cannot move either.
+	for (int i=0; i<(int)fs->files.size(); ++i) {
+		FAT_FILE * file = fs->files[i];
+		if (file->mapped_views == 0)
+			continue;
+		mapped[file->metadata_block_id] = true;
+		for (int j=0; j<(int)file->block_ids.size(); ++j) {
+			mapped[file->block_ids[j]] = true;
+		}
+	}
+	int cleaned = 0;
+	while (mini_fat_log_clean_count(fs, pending) < clean_segments && cleaned < mini_fat_log_segment_count(fs)) {
+		int victim = -1, victim_live = 0;
+		int head_segment = fs->log_head > 0 ? (fs->log_head - 1) / fs->segment_blocks : -1;
+		for (int i=0; i<mini_fat_log_segment_count(fs); ++i) {
+			int first, end, live = 0;
+			bool is_pinned = false; // Disk metadata, snapshot blocks and mapped blocks cannot move.
+			mini_fat_log_segment_range(fs, i, &first, &end);
+			for (int j=first; j<end; ++j) {
+				live += fs->block_map[j] != EMPTY_BLOCK && !pending[j];
+				is_pinned |= fs->block_map[j] == METADATA_BLOCK || fs->block_map[j] == SNAPSHOT_BLOCK
+					|| fs->block_map[j] == SNAPSHOT_DATA_BLOCK || fs->snapshot_blocks[j] || mapped[j];
+			}
+			if (live == 0 || is_pinned || i == head_segment || live * 100 > (end - first) * FAT_CLEANER_MAX_LIVE_PERCENT)
+				continue;
+			if (victim == -1 || live < victim_live) {
+				victim = i;
+				victim_live = live;
+			}
+		}
+		if (victim == -1 || !mini_fat_log_clean_segment(fs, victim, pending))
+			break;
+		cleaned++;
+	}
+	return cleaned;
+}
+
+static void * mini_fat_log_cleaner(void * arg) {
+	FAT_FILESYSTEM * fs = (FAT_FILESYSTEM *)arg;
+	pthread_mutex_lock(&fs->cleaner_lock);
+	while (fs->is_cleaner_running) {
+		struct timespec deadline;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_nsec += FAT_CLEANER_PERIOD_MS * 1000000L;
+		deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+		deadline.tv_nsec %= 1000000000L;
+		pthread_cond_timedwait(&fs->cleaner_wakeup, &fs->cleaner_lock, &deadline);
+		if (!fs->is_cleaner_running)
+			break;
+
+		pthread_mutex_unlock(&fs->cleaner_lock);
+		mini_fat_log_clean(fs, FAT_CLEANER_MIN_CLEAN_SEGMENTS);
+		pthread_mutex_lock(&fs->cleaner_lock);
+	}
+	pthread_mutex_unlock(&fs->cleaner_lock);
+	return NULL;
+}
+
+/**
+ * Stop the background cleaner of a disk, if it runs.
+ */
+void mini_fat_log_stop_cleaner(FAT_FILESYSTEM *fs) {
+	pthread_mutex_lock(&fs->cleaner_lock);
+	bool was_running = fs->is_cleaner_running;
+	fs->is_cleaner_running = false;
+	pthread_cond_signal(&fs->cleaner_wakeup);
+	pthread_mutex_unlock(&fs->cleaner_lock);
+	if (was_running)
+		pthread_join(fs->cleaner, NULL);
+}
+
+/**
+ * Switch a disk to log-structured mode: blocks that are overwritten, new
+ * blocks and file entries are all written at a moving log head instead of
+ * in place, so random small writes become sequential disk writes. The disk
+ * is divided in segments of segment_blocks blocks; a background thread
+ * cleans the emptiest segments so the head always finds clean ones. Moved
+ * blocks invalidate file views. The mode is not stored on disk.
+ * @param  segment_blocks blocks per segment, 0 to go back to in-place writes.
+ * @return false if the cleaner thread cannot be started.
+ */
+bool mini_fat_set_log_structured(FAT_FILESYSTEM *fs, const int segment_blocks) {
+	assert(segment_blocks >= 0);
+	mini_fat_log_stop_cleaner(fs);
+
+	FAT_LOCK lock(fs, true);
+	fs->log_structured = segment_blocks > 0;
+	if (!fs->log_structured)
+		return true;
+	fs->segment_blocks = segment_blocks;
+	fs->log_head = -1;
+
+	fs->is_cleaner_running = true;
+	int error = pthread_create(&fs->cleaner, NULL, mini_fat_log_cleaner, fs);
+	if (error != 0) {
+		errno = error;
+		perror("Cannot start log cleaner");
+		fs->is_cleaner_running = false;
+		fs->log_structured = false;
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,304 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "fat.h"
+#include "fat_file.h"
+
+// A snapshot header block starts with the name length, the entry count, the
+// next header block (-1 for the last one) and the 64-bit creation time,
+// followed by the name (without terminator) and the entry blocks of the
+// files, as many as fit. The list goes on in the next header blocks, whose
+// name length is 0 and whose other fields are unused. The entry blocks, and
+// the data blocks they list, are shared with the live files until these
+// overwrite them.
+const int SNAPSHOT_HEADER_SIZE = 3 * sizeof(int) + sizeof(long long);
+
+// Number of entry blocks a header block can list after a name of name_length.
+static int mini_fat_snapshot_capacity(const FAT_FILESYSTEM *fs, const int name_length) {
+	return (fs->block_size - SNAPSHOT_HEADER_SIZE - name_length) / (int)sizeof(int);
+}
+
+/**
+ * Find a snapshot by name.
+ * @return index in fs->snapshots, or -1.
+ */
+static int mini_fat_find_snapshot(const FAT_FILESYSTEM *fs, const char * name) {
+	for (int i=0; i<(int)fs->snapshots.size(); ++i) {
+		if (strcmp(fs->snapshots[i].name, name) == 0)
+			return i;
+	}
+	return -1;
+}
+
+/**
+ * Fill the block list of a snapshot from its entry blocks: the entries
+ * themselves, and the data blocks holding bytes within the file sizes.
+ * Blocks past the size of a file hold no snapshot data, so live files may
+ * write to them in place.
+ */
+static void mini_fat_snapshot_collect(FAT_FILESYSTEM *fs, FAT_SNAPSHOT * snapshot) {
+	snapshot->block_ids = snapshot->entry_block_ids;
+	for (int i=0; i<(int)snapshot->entry_block_ids.size(); ++i) {
+		FAT_FILE * file = mini_file_load_entry(fs, snapshot->entry_block_ids[i]);
+		if (!file)
+			continue;
+		int used = (file->size + fs->block_size - 1) / fs->block_size;
+		for (int j=0; j<used && j<(int)file->block_ids.size(); ++j) {
+			snapshot->block_ids.push_back(file->block_ids[j]);
+		}
+		delete file;
+	}
+}
+
+// Recompute fs->snapshot_blocks from the block lists of all snapshots.
+static void mini_fat_snapshot_refresh(FAT_FILESYSTEM *fs) {
+	fs->snapshot_blocks.assign(fs->block_count, false);
+	for (int i=0; i<(int)fs->snapshots.size(); ++i) {
+		const std::vector<int> &block_ids = fs->snapshots[i].block_ids;
+		for (int j=0; j<(int)block_ids.size(); ++j) {
+			fs->snapshot_blocks[block_ids[j]] = true;
+		}
+	}
+}
+
+/**
+ * Refuse changes to a disk that is a mounted snapshot.
+ * @return true (after an error message) if the disk is read-only.
+ */
+bool mini_fat_is_read_only(const FAT_FILESYSTEM *fs) {
+	if (fs->mounted_snapshot == NULL)
+		return false;
+	fprintf(stderr, "Cannot change snapshot '%s': it is read-only.\n", fs->mounted_snapshot);
+	return true;
+}
+
+/**
+ * Read a snapshot header starting at block_id, following its next header
+ * blocks.
+ * @return false (after an error message) if a header block cannot be read or
+ *         is corrupted.
+ */
+static bool mini_fat_read_snapshot(FAT_FILESYSTEM *fs, const int block_id, FAT_SNAPSHOT * snapshot) {
+	std::vector<char> header_block(fs->block_size);
+	int entry_count = 0;
+	for (int i=block_id; i != -1; ) {
+		if (i < 0 || i >= fs->block_count || fs->block_map[i] != SNAPSHOT_BLOCK
+			|| (int)snapshot->header_block_ids.size() == fs->block_count) {
+			fprintf(stderr, "Corrupted snapshot header in block %d.\n", block_id);
+			return false;
+		}
+		if (mini_fat_read_in_block(fs, i, 0, fs->block_size, &header_block[0]) != fs->block_size) {
+			fprintf(stderr, "Cannot read snapshot header in block %d.\n", i);
+			return false;
+		}
+		int header[3];
+		memcpy(header, &header_block[0], sizeof(header));
+		int name_length = header[0];
+		bool is_first = snapshot->header_block_ids.empty();
+		if (is_first) {
+			entry_count = header[1];
+			memcpy(&snapshot->created, &header_block[sizeof(header)], sizeof(snapshot->created));
+		}
+		if ((is_first ? name_length <= 0 || name_length >= MAX_SNAPSHOT_NAME_LENGTH : name_length != 0)
+			|| entry_count < 0 || mini_fat_snapshot_capacity(fs, name_length) < 0) {
+			fprintf(stderr, "Corrupted snapshot header in block %d.\n", i);
+			return false;
+		}
+		if (is_first) {
+			memcpy(snapshot->name, &header_block[SNAPSHOT_HEADER_SIZE], name_length);
+			snapshot->name[name_length] = 0;
+		}
+		int count = std::min(mini_fat_snapshot_capacity(fs, name_length), entry_count - (int)snapshot->entry_block_ids.size());
+		int offset = snapshot->entry_block_ids.size();
+		snapshot->entry_block_ids.resize(offset + count);
+		if (count > 0)
+			memcpy(&snapshot->entry_block_ids[offset], &header_block[SNAPSHOT_HEADER_SIZE + name_length], count * sizeof(int));
+		snapshot->header_block_ids.push_back(i);
+		i = header[2];
+	}
+	if ((int)snapshot->entry_block_ids.size() != entry_count) {
+		fprintf(stderr, "Corrupted snapshot header in block %d.\n", block_id);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Read the header of every snapshot of a freshly loaded disk.
+ */
+void mini_fat_load_snapshots(FAT_FILESYSTEM *fs) {
+	int name_length;
+	for (int i=0; i<fs->block_count; ++i) {
+		if (fs->block_map[i] != SNAPSHOT_BLOCK)
+			continue;
+		// Next header blocks are read with the first one.
+		if (mini_fat_read_in_block(fs, i, 0, sizeof(name_length), &name_length) == sizeof(name_length) && name_length == 0)
+			continue;
+
+		FAT_SNAPSHOT snapshot;
+		if (!mini_fat_read_snapshot(fs, i, &snapshot))
+			continue;
+		mini_fat_snapshot_collect(fs, &snapshot);
+		fs->snapshots.push_back(snapshot);
+	}
+	mini_fat_snapshot_refresh(fs);
+}
+
+/**
+ * Replace the files of a loaded disk with the files of one of its snapshots,
+ * and make the disk read-only.
+ * @return false if there is no such snapshot.
+ */
+bool mini_fat_mount_snapshot(FAT_FILESYSTEM *fs, const char * name) {
+	int index = mini_fat_find_snapshot(fs, name);
+	if (index == -1) {
+		fprintf(stderr, "Cannot mount snapshot '%s': no such snapshot in '%s'.\n", name, fs->filename);
+		return false;
+	}
+	for (int i=0; i<(int)fs->files.size(); ++i) {
+		delete fs->files[i];
+	}
+	fs->files.clear();
+
+	const FAT_SNAPSHOT &snapshot = fs->snapshots[index];
+	for (int i=0; i<(int)snapshot.entry_block_ids.size(); ++i) {
+		FAT_FILE * file = mini_file_load_entry(fs, snapshot.entry_block_ids[i]);
+		if (file)
+			fs->files.push_back(file);
+	}
+	fs->mounted_snapshot = snapshot.name;
+	return true;
+}
+
+/**
+ * Give blocks of a live file that are shared with a snapshot a copy of their
+ * own before they are overwritten. All new blocks are allocated at once, so
+ * either every shared block is replaced or none is. The old blocks stay with
+ * the snapshot.
+ * @param  blocks        block references of one type (entry or data), replaced in place
+ * @param  keep_contents per block, whether the old contents must be copied
+ * @return false if the disk is full (nothing changes).
+ */
+bool mini_fat_snapshot_unshare(FAT_FILESYSTEM *fs, const std::vector<int*> &blocks, const std::vector<bool> &keep_contents) {
+	std::vector<int> shared; // Indexes in blocks.
+	for (int i=0; i<(int)blocks.size(); ++i) {
+		if (fs->snapshot_blocks[*blocks[i]])
+			shared.push_back(i);
+	}
+	if (shared.empty())
+		return true;
+
+	std::vector<int> new_block_ids;
+	int first = *blocks[shared[0]];
+	if (!mini_fat_allocate_blocks(fs, shared.size(), fs->block_map[first], first, new_block_ids))
+		return false;
+	std::vector<int> old_block_ids;
+	for (int i=0; i<(int)shared.size(); ++i) {
+		int * block = blocks[shared[i]];
+		if (keep_contents[shared[i]])
+			mini_fat_copy_range(fs, *block, 0, new_block_ids[i], 0, fs->block_size);
+		old_block_ids.push_back(*block);
+		*block = new_block_ids[i];
+	}
+	mini_fat_free_blocks(fs, old_block_ids);
+	return true;
+}
+
+/**
+ * Take a read-only point-in-time snapshot of every file of the disk. The
+ * metadata is saved first; the snapshot then only records the entry blocks
+ * of the files in header blocks, so it costs one block per block_size / 4
+ * files or so. Entry and data
+ * blocks are shared with the live files, which copy them before overwriting
+ * them (copy-on-write) and leave them to the snapshot when freeing them.
+ * The snapshot is saved to disk and can be mounted with
+ * mini_fat_load("disk@name") or mini_fat_load_snapshot.
+ * @return false if the name is taken or too long, or the disk is full.
+ */
+bool mini_fat_create_snapshot(FAT_FILESYSTEM *fs, const char * name) {
+	FAT_LOCK lock(fs, true);
+	if (mini_fat_is_read_only(fs))
+		return false;
+	int name_length = strlen(name);
+	if (name_length == 0 || name_length >= MAX_SNAPSHOT_NAME_LENGTH || mini_fat_find_snapshot(fs, name) != -1) {
+		fprintf(stderr, "Cannot create snapshot '%s': name is taken or too long.\n", name);
+		return false;
+	}
+	int first_capacity = mini_fat_snapshot_capacity(fs, name_length), next_capacity = mini_fat_snapshot_capacity(fs, 0);
+	if (first_capacity < 0 || next_capacity < 1) {
+		fprintf(stderr, "Cannot create snapshot '%s': blocks are too small for its header.\n", name);
+		return false;
+	}
+
+	// Entries on disk must match the files before they are frozen.
+	if (!mini_fat_write_metadata(fs, fs->files, true))
+		return false;
+	int file_count = fs->files.size();
+	int header_blocks = 1 + std::max(0, (file_count - first_capacity + next_capacity - 1) / next_capacity);
+	FAT_SNAPSHOT snapshot;
+	if (!mini_fat_allocate_blocks(fs, header_blocks, SNAPSHOT_BLOCK, -1, snapshot.header_block_ids)) {
+		fprintf(stderr, "Cannot create snapshot '%s': disk is full.\n", name);
+		return false;
+	}
+	strcpy(snapshot.name, name);
+	snapshot.created = time(NULL);
+	for (int i=0; i<file_count; ++i) {
+		snapshot.entry_block_ids.push_back(fs->files[i]->metadata_block_id);
+	}
+
+	std::vector<char> header_block(fs->block_size);
+	for (int i=0, written=0; i<header_blocks; ++i) {
+		int length = i == 0 ? name_length : 0;
+		int count = std::min(mini_fat_snapshot_capacity(fs, length), file_count - written);
+		int header[3] = {length, file_count, i + 1 < header_blocks ? snapshot.header_block_ids[i+1] : -1};
+		std::fill(header_block.begin(), header_block.end(), 0);
+		memcpy(&header_block[0], header, sizeof(header));
+		if (i == 0) {
+			memcpy(&header_block[sizeof(header)], &snapshot.created, sizeof(snapshot.created));
+			memcpy(&header_block[SNAPSHOT_HEADER_SIZE], name, name_length);
+		}
+		if (count > 0)
+			memcpy(&header_block[SNAPSHOT_HEADER_SIZE + length], &snapshot.entry_block_ids[written], count * sizeof(int));
+		if (mini_fat_write_in_block(fs, snapshot.header_block_ids[i], 0, fs->block_size, &header_block[0]) != fs->block_size) {
+			mini_fat_free_blocks(fs, snapshot.header_block_ids);
+			return false;
+		}
+		written += count;
+	}
+
+	mini_fat_snapshot_collect(fs, &snapshot);
+	fs->snapshots.push_back(snapshot);
+	mini_fat_snapshot_refresh(fs);
+	// Only now does the block map show the header, so it never points to a partial one.
+	return mini_fat_write_metadata(fs, std::vector<FAT_FILE *>());
+}
+
+/**
+ * Delete a snapshot, freeing its header and the blocks that no live file and
+ * no other snapshot uses any more. The change is saved to disk.
+ * @return false if there is no such snapshot.
+ */
+bool mini_fat_delete_snapshot(FAT_FILESYSTEM *fs, const char * name) {
+	FAT_LOCK lock(fs, true);
+	if (mini_fat_is_read_only(fs))
+		return false;
+	int index = mini_fat_find_snapshot(fs, name);
+	if (index == -1) {
+		fprintf(stderr, "Cannot delete snapshot '%s': no such snapshot.\n", name);
+		return false;
+	}
+	std::vector<int> freed = fs->snapshots[index].header_block_ids;
+	fs->snapshots.erase(fs->snapshots.begin() + index);
+	mini_fat_snapshot_refresh(fs);
+
+	for (int i=0; i<fs->block_count; ++i) {
+		if (fs->block_map[i] == SNAPSHOT_DATA_BLOCK && !fs->snapshot_blocks[i])
+			freed.push_back(i);
+	}
+	mini_fat_free_blocks(fs, freed);
+	return mini_fat_write_metadata(fs, std::vector<FAT_FILE *>());
+}
@@ -1,3 +1,13 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <pthread.h>
+
+#include <algorithm>
+
 #include "fat.h"
 #include "fat_file.h"
 
@@ -38,6 +48,432 @@ void test_small_filesystem(FAT_FILESYSTEM * fs) {
 	score(fd3 == NULL);
 }
 
+void test_inline(FAT_FILESYSTEM * fs) {
+	FAT_OPEN_FILE *fd1;
+	char buffer[1024];
+
+	printf("Writing a small file should keep its data in the entry block.\n");
+	fd1 = mini_file_open(fs, "small.txt", true);
+	score(mini_file_write(fs, fd1, strlen(fox), fox) == 45);
+	score(fd1->file->block_ids.empty());
+	mini_file_close(fs, fd1);
+
+	printf("Small file should survive save/load.\n");
+	score(mini_fat_save(fs));
+	FAT_FILESYSTEM * loaded_fs = mini_fat_load(fs->filename);
+	fd1 = mini_file_open(loaded_fs, "small.txt", false);
+	memset(buffer, 0, sizeof(buffer));
+	score(fd1 != NULL && mini_file_read(loaded_fs, fd1, sizeof(buffer), buffer) == 45 && strcmp(buffer, fox) == 0);
+	mini_file_close(loaded_fs, fd1);
+
+	printf("Growing past the entry block should move the data to data blocks.\n");
+	fd1 = mini_file_open(loaded_fs, "small.txt", true);
+	for (int i=0; i<10; ++i)
+		mini_file_write(loaded_fs, fd1, strlen(fox), fox);
+	score(mini_file_size(loaded_fs, "small.txt") == 45*11);
+	score(!fd1->file->block_ids.empty());
+	mini_file_seek(loaded_fs, fd1, 0, true);
+	memset(buffer, 0, sizeof(buffer));
+	score(mini_file_read(loaded_fs, fd1, 45, buffer) == 45 && strcmp(buffer, fox) == 0);
+	mini_file_close(loaded_fs, fd1);
+}
+
+// Bytes actually used on the host by a disk file.
+long long disk_usage(const char * filename) {
+	struct stat st;
+	stat(filename, &st);
+	return (long long)st.st_blocks * 512;
+}
+
+void test_discard(FAT_FILESYSTEM * fs) {
+	FAT_OPEN_FILE *fd1;
+	char buffer[4096];
+
+	fs->discard = true;
+	memset(buffer, 'x', sizeof(buffer));
+	fd1 = mini_file_open(fs, "big.txt", true);
+	for (int i=0; i<16; ++i)
+		mini_file_write(fs, fd1, sizeof(buffer), buffer);
+	mini_fat_save(fs);
+	long long used = disk_usage(fs->filename);
+
+	printf("Truncating a file should free its blocks and shrink the disk file.\n");
+	score(mini_file_truncate(fs, fd1, 4096 * 4));
+	score(mini_file_size(fs, "big.txt") == 4096 * 4 && fd1->file->block_ids.size() == 4);
+	score(disk_usage(fs->filename) <= used - 4096 * 12);
+	mini_file_close(fs, fd1);
+
+	printf("Deleting a file should free the rest.\n");
+	score(mini_file_delete(fs, "big.txt"));
+	score(disk_usage(fs->filename) <= used - 4096 * 16);
+}
+
+void test_resize(FAT_FILESYSTEM * fs) {
+	FAT_OPEN_FILE *fd1, *fd2;
+	char buffer[6 * 1024], copy[6 * 1024];
+	struct stat st;
+
+	for (int i=0; i<(int)sizeof(buffer); ++i)
+		buffer[i] = 'a' + i % 26;
+	fd1 = mini_file_open(fs, "first.txt", true);
+	mini_file_write(fs, fd1, 6 * 1024, buffer);
+	mini_file_close(fs, fd1);
+	fd2 = mini_file_open(fs, "second.txt", true);
+	mini_file_write(fs, fd2, 4000, buffer);
+	mini_file_delete(fs, "first.txt");
+
+	printf("Shrinking below the live blocks should fail:\n");
+	score(mini_fat_resize(fs, 4) == false);
+
+	printf("Shrinking should move the blocks of an open file below the new end.\n");
+	score(mini_fat_resize(fs, 8));
+	stat(fs->filename, &st);
+	score(st.st_size == 8 * 1024 && fs->block_count == 8);
+	mini_file_seek(fs, fd2, 0, true);
+	memset(copy, 0, sizeof(copy));
+	score(mini_file_read(fs, fd2, 4000, copy) == 4000 && memcmp(copy, buffer, 4000) == 0);
+
+	printf("Growing should add empty blocks to the open disk.\n");
+	score(mini_fat_resize(fs, 24));
+	score(mini_file_write(fs, fd2, 4096, buffer) == 4096);
+	mini_file_close(fs, fd2);
+	mini_fat_save(fs);
+
+	FAT_FILESYSTEM * loaded_fs = mini_fat_load(fs->filename);
+	score(loaded_fs->block_count == 24 && mini_file_size(loaded_fs, "second.txt") == 4000 + 4096);
+}
+
+void test_resize_metadata(FAT_FILESYSTEM * fs) {
+	char buffer[1000];
+	memset(buffer, 'm', sizeof(buffer));
+	FAT_OPEN_FILE * fd1 = mini_file_open(fs, "meta.txt", true);
+	mini_file_write(fs, fd1, sizeof(buffer), buffer);
+	mini_file_close(fs, fd1);
+
+	printf("Shrinking below a metadata block boundary should free the metadata blocks no longer needed:\n");
+	int metadata_blocks = mini_fat_metadata_block_count(fs->block_size, 200);
+	int used = fs->block_count - std::count(fs->block_map.begin(), fs->block_map.end(), EMPTY_BLOCK)
+		- mini_fat_metadata_block_count(fs->block_size, fs->block_count);
+	score(metadata_blocks < mini_fat_metadata_block_count(fs->block_size, fs->block_count) && mini_fat_resize(fs, 200));
+	score(std::count(fs->block_map.begin(), fs->block_map.end(), EMPTY_BLOCK) == 200 - metadata_blocks - used);
+	FAT_FILESYSTEM * loaded_fs = mini_fat_load(fs->filename);
+	score(std::count(loaded_fs->block_map.begin(), loaded_fs->block_map.end(), EMPTY_BLOCK) == 200 - metadata_blocks - used
+		&& mini_file_size(loaded_fs, "meta.txt") == (int)sizeof(buffer));
+	mini_fat_close(loaded_fs);
+	mini_fat_close(fs);
+}
+
+void test_striped(const std::vector<const char *> &filenames) {
+	FAT_FILESYSTEM * fs = mini_fat_create_striped(filenames, 4096, 48);
+	FAT_OPEN_FILE *fd1;
+	static char buffer[40 * 4096], copy[40 * 4096];
+	struct stat st;
+
+	for (int i=0; i<(int)sizeof(buffer); ++i)
+		buffer[i] = 'a' + i % 23;
+	printf("A striped disk should spread its blocks over all files:\n");
+	stat(filenames[1], &st);
+	score(fs != NULL && st.st_size == 16 * 4096);
+
+	fd1 = mini_file_open(fs, "striped.txt", true);
+	score(mini_file_write(fs, fd1, sizeof(buffer), buffer) == sizeof(buffer));
+	mini_file_close(fs, fd1);
+	fd1 = mini_file_open(fs, "striped.txt", false);
+	score(mini_file_read(fs, fd1, sizeof(copy), copy) == sizeof(copy) && memcmp(copy, buffer, sizeof(buffer)) == 0);
+	mini_file_close(fs, fd1);
+	mini_fat_save(fs);
+
+	printf("Loading a striped disk should find the file again:\n");
+	FAT_FILESYSTEM * loaded_fs = mini_fat_load_striped(filenames);
+	fd1 = mini_file_open(loaded_fs, "striped.txt", false);
+	memset(copy, 0, sizeof(copy));
+	mini_file_seek(loaded_fs, fd1, 5000, true);
+	score(mini_file_read(loaded_fs, fd1, 20000, copy) == 20000 && memcmp(copy, buffer + 5000, 20000) == 0);
+}
+
+void test_mirrored(const std::vector<const char *> &filenames) {
+	char fox[] = "The quick brown fox jumps over the lazy dog.";
+	char buffer[64];
+	FAT_FILESYSTEM * fs = mini_fat_create_mirrored(filenames, 256, 32);
+	FAT_OPEN_FILE * fd1 = mini_file_open(fs, "mirrored.txt", true);
+	for (int i=0; i<20; ++i)
+		mini_file_write(fs, fd1, strlen(fox), fox);
+	mini_fat_save(fs);
+	mini_fat_close(fs);
+
+	printf("Every copy of a mirrored disk should load on its own:\n");
+	FAT_FILESYSTEM * copy_fs = mini_fat_load(filenames[1]);
+	fd1 = mini_file_open(copy_fs, "mirrored.txt", false);
+	mini_file_seek(copy_fs, fd1, 19 * strlen(fox), true);
+	score(mini_file_read(copy_fs, fd1, sizeof(buffer), buffer) == (int)strlen(fox) && memcmp(buffer, fox, strlen(fox)) == 0);
+	mini_fat_close(copy_fs);
+
+	printf("A lost copy should be stale until a resync rebuilds it:\n");
+	unlink(filenames[1]);
+	FAT_FILESYSTEM * loaded_fs = mini_fat_load_mirrored(filenames);
+	score(!loaded_fs->replicas[0].is_stale && loaded_fs->replicas[1].is_stale);
+	score(mini_fat_resync(loaded_fs) == 0 && !loaded_fs->replicas[1].is_stale);
+	mini_fat_close(loaded_fs);
+	copy_fs = mini_fat_load(filenames[1]);
+	score(mini_file_size(copy_fs, "mirrored.txt") == 20 * (int)strlen(fox));
+	mini_fat_close(copy_fs);
+
+	printf("A loaded mirrored disk should not be mapped, and reopening should keep the newest copy:\n");
+	unlink(filenames[0]);
+	loaded_fs = mini_fat_load_mirrored(filenames);
+	score(loaded_fs->map == NULL && loaded_fs->fd == loaded_fs->replicas[1].fd);
+	score(mini_fat_set_direct_io(loaded_fs, false) && loaded_fs->fd == loaded_fs->replicas[1].fd);
+	fd1 = mini_file_open(loaded_fs, "mirrored.txt", false);
+	score(mini_file_read(loaded_fs, fd1, sizeof(buffer), buffer) == (int)sizeof(buffer) && memcmp(buffer, fox, strlen(fox)) == 0);
+	mini_fat_resync(loaded_fs);
+	mini_fat_close(loaded_fs);
+}
+
+void test_log_structured(FAT_FILESYSTEM * fs) {
+	FAT_OPEN_FILE *fd1;
+	char buffer[16 * 1024], copy[16 * 1024], patch[1024];
+	const int offsets[3] = {3 * 1024 + 10, 9 * 1024 + 500, 1 * 1024};
+
+	for (int i=0; i<(int)sizeof(buffer); ++i)
+		buffer[i] = 'a' + i % 19;
+	memset(patch, 'x', sizeof(patch));
+	mini_fat_set_log_structured(fs, 8);
+	fd1 = mini_file_open(fs, "log.txt", true);
+	mini_file_write(fs, fd1, sizeof(buffer), buffer);
+	std::vector<int> old_blocks = fd1->file->block_ids;
+
+	printf("Random overwrites should be appended at the log head, one after the other:\n");
+	for (int i=0; i<3; ++i) {
+		mini_file_seek(fs, fd1, offsets[i], true);
+		mini_file_write(fs, fd1, 100, patch);
+		memcpy(buffer + offsets[i], patch, 100);
+	}
+	std::vector<int> &blocks = fd1->file->block_ids;
+	score(blocks[3] != old_blocks[3] && blocks[9] == blocks[3] + 1 && blocks[1] == blocks[9] + 1);
+	score(blocks[2] == old_blocks[2]);
+	mini_file_seek(fs, fd1, 0, true);
+	score(mini_file_read(fs, fd1, sizeof(copy), copy) == sizeof(copy) && memcmp(copy, buffer, sizeof(buffer)) == 0);
+
+	printf("Overwrites should not move blocks while a view of the file is mapped:\n");
+	FAT_FILE_VIEW * view = mini_file_map(fs, fd1, 0, 100);
+	mini_file_seek(fs, fd1, 0, true);
+	score(mini_file_write(fs, fd1, 100, patch) == 0 && blocks[0] == old_blocks[0]);
+	mini_file_unmap(view);
+
+	printf("Cleaning should free segments and keep the data:\n");
+	mini_file_truncate(fs, fd1, 12 * 1024);
+	score(mini_fat_log_clean(fs, 4) > 0);
+	mini_file_seek(fs, fd1, 0, true);
+	score(mini_file_read(fs, fd1, sizeof(copy), copy) == 12 * 1024 && memcmp(copy, buffer, 12 * 1024) == 0);
+	mini_file_close(fs, fd1);
+	mini_fat_save(fs);
+
+	FAT_FILESYSTEM * loaded_fs = mini_fat_load(fs->filename);
+	fd1 = mini_file_open(loaded_fs, "log.txt", false);
+	memset(copy, 0, sizeof(copy));
+	score(mini_file_read(loaded_fs, fd1, sizeof(copy), copy) == 12 * 1024 && memcmp(copy, buffer, 12 * 1024) == 0);
+	mini_fat_close(loaded_fs);
+
+	printf("Blocks moved by the cleaner should keep their old copy on disk until the next save:\n");
+	old_blocks = fs->files[0]->block_ids;
+	fd1 = mini_file_open(fs, "other.txt", true);
+	mini_file_write(fs, fd1, 8 * 1024, copy);
+	mini_fat_log_clean(fs, 6);
+	score(fs->files[0]->block_ids != old_blocks);
+	for (int i=0; i<16; ++i)
+		mini_file_write(fs, fd1, sizeof(patch), patch); // Fills the disk: would reuse the old copies if they were free.
+	mini_file_close(fs, fd1);
+	loaded_fs = mini_fat_load(fs->filename); // As after a crash: nothing saved since.
+	fd1 = mini_file_open(loaded_fs, "log.txt", false);
+	memset(copy, 0, sizeof(copy));
+	score(mini_file_read(loaded_fs, fd1, sizeof(copy), copy) == 12 * 1024 && memcmp(copy, buffer, 12 * 1024) == 0);
+	mini_fat_close(loaded_fs);
+	mini_fat_close(fs);
+}
+
+void test_direct_io(FAT_FILESYSTEM * fs) {
+	FAT_OPEN_FILE *fd1;
+	char buffer[5000], copy[5000];
+
+	for (int i=0; i<(int)sizeof(buffer); ++i)
+		buffer[i] = 'a' + i % 17;
+	printf("Unaligned writes and reads should work with O_DIRECT:\n");
+	score(mini_fat_set_direct_io(fs, true) && fs->map == NULL);
+	fd1 = mini_file_open(fs, "direct.txt", true);
+	mini_file_write(fs, fd1, strlen(fox), fox);
+	score(mini_file_write(fs, fd1, sizeof(buffer), buffer) == sizeof(buffer));
+	mini_file_close(fs, fd1);
+	fd1 = mini_file_open(fs, "direct.txt", false);
+	mini_file_seek(fs, fd1, strlen(fox), true);
+	memset(copy, 0, sizeof(copy));
+	score(mini_file_read(fs, fd1, sizeof(copy), copy) == sizeof(copy) && memcmp(copy, buffer, sizeof(buffer)) == 0);
+	mini_file_close(fs, fd1);
+	mini_fat_save(fs);
+
+	FAT_FILESYSTEM * loaded_fs = mini_fat_load(fs->filename);
+	fd1 = mini_file_open(loaded_fs, "direct.txt", false);
+	memset(copy, 0, sizeof(copy));
+	score(mini_file_read(loaded_fs, fd1, strlen(fox), copy) == (int)strlen(fox) && memcmp(copy, fox, strlen(fox)) == 0);
+	mini_fat_close(loaded_fs);
+	mini_fat_close(fs);
+}
+
+void test_batch(FAT_FILESYSTEM * fs) {
+	static char names[40][16];
+	std::vector<FAT_BATCH_OP> ops;
+	for (int i=0; i<40; ++i) {
+		sprintf(names[i], "batch%d.txt", i);
+		FAT_BATCH_OP op = {FAT_BATCH_CREATE, names[i], NULL, 0, false};
+		ops.push_back(op);
+	}
+	FAT_BATCH_OP more[4] = {
+		{FAT_BATCH_DELETE, "batch3.txt", NULL, 0, false},
+		{FAT_BATCH_SET_SIZE, "batch5.txt", NULL, 100, false},
+		{FAT_BATCH_RENAME, "batch5.txt", "renamed.txt", 0, false},
+		{FAT_BATCH_CREATE, "batch7.txt", NULL, 0, false},
+	};
+	ops.insert(ops.end(), more, more + 4);
+
+	printf("A batch should apply every valid operation:\n");
+	score(mini_file_batch(fs, ops) == 43 && !ops[43].is_done);
+	score(fs->files.size() == 39 && mini_file_find(fs, "batch3.txt") == NULL);
+	FAT_FILE * file = mini_file_find(fs, "batch10.txt");
+	score(file && file->metadata_block_id == mini_file_find(fs, "batch9.txt")->metadata_block_id + 1);
+
+	printf("The batch should be on disk without saving:\n");
+	FAT_FILESYSTEM * loaded_fs = mini_fat_load(fs->filename);
+	char buffer[100];
+	memset(buffer, 'x', sizeof(buffer));
+	FAT_OPEN_FILE * fd1 = mini_file_open(loaded_fs, "renamed.txt", false);
+	score(loaded_fs->files.size() == 39 && fd1 && mini_file_read(loaded_fs, fd1, 100, buffer) == 100 && buffer[0] == 0 && buffer[99] == 0);
+	mini_fat_close(loaded_fs);
+
+	printf("A batch whose metadata cannot be written should report it:\n");
+	std::vector<FAT_BATCH_OP> unsaved(1, ops[0]);
+	unsaved[0].name = "unsaved.txt";
+	int disk_fd = fs->fd;
+	fs->fd = -1; // As if the disk had gone away.
+	score(mini_file_batch(fs, unsaved) == -1);
+	fs->fd = disk_fd;
+}
+
+void test_snapshot(FAT_FILESYSTEM * fs) {
+	char data[3000], buffer[3000];
+	memset(data, 'a', sizeof(data));
+	FAT_OPEN_FILE * fd1 = mini_file_open(fs, "data.txt", true);
+	mini_file_write(fs, fd1, sizeof(data), data);
+	FAT_OPEN_FILE * fd2 = mini_file_open(fs, "small.txt", true);
+	mini_file_write(fs, fd2, 5, "hello");
+
+	printf("A snapshot should only take a header block:\n");
+	int used = fs->block_count - std::count(fs->block_map.begin(), fs->block_map.end(), EMPTY_BLOCK);
+	score(mini_fat_create_snapshot(fs, "hourly") && !mini_fat_create_snapshot(fs, "hourly"));
+	score(fs->block_count - std::count(fs->block_map.begin(), fs->block_map.end(), EMPTY_BLOCK) == used + 1);
+
+	printf("Live files should copy shared blocks before overwriting them:\n");
+	int first_block = fs->files[0]->block_ids[0];
+	memset(data, 'b', 1500);
+	mini_file_seek(fs, fd1, 0, true);
+	mini_file_write(fs, fd1, 1500, data);
+	mini_file_write(fs, fd2, 6, " world");
+	mini_file_close(fs, fd1);
+	mini_file_close(fs, fd2);
+	mini_file_delete(fs, "small.txt");
+	mini_file_close(fs, mini_file_open(fs, "new.txt", true));
+	score(fs->files[0]->block_ids[0] != first_block && fs->block_map[first_block] == SNAPSHOT_DATA_BLOCK);
+	mini_fat_save(fs);
+
+	printf("A mounted snapshot should show the files as they were, read-only:\n");
+	FAT_FILESYSTEM * snapshot_fs = mini_fat_load("snap.fat@hourly");
+	fd1 = snapshot_fs ? mini_file_open(snapshot_fs, "data.txt", false) : NULL;
+	memset(data, 'a', 1500);
+	score(fd1 && mini_file_read(snapshot_fs, fd1, 3000, buffer) == 3000 && memcmp(buffer, data, 3000) == 0);
+	fd2 = snapshot_fs ? mini_file_open(snapshot_fs, "small.txt", false) : NULL;
+	score(fd2 && mini_file_read(snapshot_fs, fd2, 100, buffer) == 5 && memcmp(buffer, "hello", 5) == 0);
+	score(snapshot_fs && snapshot_fs->files.size() == 2 && !mini_file_open(snapshot_fs, "data.txt", true) && !mini_fat_save(snapshot_fs));
+	mini_fat_close(snapshot_fs);
+
+	printf("Deleting the snapshot should free the blocks only it used:\n");
+	FAT_FILESYSTEM * loaded_fs = mini_fat_load(fs->filename);
+	fd1 = mini_file_open(loaded_fs, "data.txt", false);
+	score(mini_file_read(loaded_fs, fd1, 3000, buffer) == 3000 && buffer[0] == 'b' && buffer[2999] == 'a');
+	score(mini_fat_delete_snapshot(loaded_fs, "hourly") && loaded_fs->snapshots.empty()
+		&& std::count(loaded_fs->block_map.begin(), loaded_fs->block_map.end(), SNAPSHOT_DATA_BLOCK) == 0);
+	mini_fat_close(loaded_fs);
+	mini_fat_close(fs);
+}
+
+void test_snapshot_many_files(FAT_FILESYSTEM * fs) {
+	char name[32];
+	for (int i=0; i<150; ++i) {
+		sprintf(name, "file%d.txt", i);
+		mini_file_close(fs, mini_file_open(fs, name, true));
+	}
+
+	printf("A snapshot of more files than one header block lists should chain header blocks:\n");
+	int used = fs->block_count - std::count(fs->block_map.begin(), fs->block_map.end(), EMPTY_BLOCK);
+	score(mini_fat_create_snapshot(fs, "many"));
+	score(fs->block_count - std::count(fs->block_map.begin(), fs->block_map.end(), EMPTY_BLOCK) == used + 3);
+	mini_file_delete(fs, "file0.txt");
+	mini_fat_save(fs);
+	FAT_FILESYSTEM * snapshot_fs = mini_fat_load("snap.fat@many");
+	score(snapshot_fs && snapshot_fs->files.size() == 150 && strcmp(snapshot_fs->files[149]->name, "file149.txt") == 0
+		&& snapshot_fs->snapshots[0].created == fs->snapshots[0].created && fs->snapshots[0].created > 0xffff);
+	mini_fat_close(snapshot_fs);
+	mini_fat_close(fs);
+}
+
+FAT_FILESYSTEM * group_fs;
+
+void * group_writer(void * arg) {
+	char name[32], buffer[1024];
+	sprintf(name, "thread%ld.txt", (long)arg);
+	memset(buffer, 'a' + (long)arg, sizeof(buffer));
+	FAT_OPEN_FILE * fd1 = mini_file_open(group_fs, name, true);
+	for (int i=0; i<20; ++i)
+		mini_file_write(group_fs, fd1, sizeof(buffer), buffer);
+	mini_file_close(group_fs, fd1);
+	return NULL;
+}
+
+void test_allocation_groups(FAT_FILESYSTEM * fs) {
+	pthread_t threads[4];
+	group_fs = fs;
+	mini_fat_set_allocation_groups(fs, 4);
+	for (long i=0; i<4; ++i)
+		pthread_create(&threads[i], NULL, group_writer, (void *)i);
+	for (int i=0; i<4; ++i)
+		pthread_join(threads[i], NULL);
+
+	printf("Files written by different threads should stay in their own groups:\n");
+	bool is_local = fs->files.size() == 4;
+	std::vector<bool> is_used(4, false);
+	for (int i=0; is_local && i<4; ++i) {
+		FAT_FILE * file = fs->files[i];
+		int group = mini_fat_block_group(fs, file->metadata_block_id);
+		is_local = !is_used[group] && file->size == 20 * 1024;
+		is_used[group] = true;
+		for (int j=0; j<(int)file->block_ids.size(); ++j)
+			is_local = is_local && mini_fat_block_group(fs, file->block_ids[j]) == group;
+	}
+	score(is_local);
+
+	printf("Reading a file while another thread writes it should only show written bytes:\n");
+	mini_file_close(fs, mini_file_open(fs, "thread4.txt", true));
+	FAT_OPEN_FILE * fd1 = mini_file_open(fs, "thread4.txt", false);
+	pthread_create(&threads[0], NULL, group_writer, (void *)4);
+	static char buffer[20 * 1024];
+	bool is_whole = true;
+	for (int i=0; i<200; ++i) {
+		mini_file_seek(fs, fd1, 0, true);
+		int read = mini_file_read(fs, fd1, sizeof(buffer), buffer);
+		is_whole = is_whole && read % 1024 == 0 && (read == 0 || (buffer[0] == 'e' && buffer[read - 1] == 'e'));
+	}
+	pthread_join(threads[0], NULL);
+	mini_file_close(fs, fd1);
+	score(is_whole && mini_file_size(fs, "thread4.txt") == 20 * 1024);
+}
+
 void test_open_3_files(FAT_FILESYSTEM * fs) {
 	FAT_OPEN_FILE *fd1, *fd2, *fd3, *fd4, *fd5, *fd6;
 	// Openning three files:
@@ -284,6 +720,116 @@ void test_seek(FAT_FILESYSTEM * fs) {
 	mini_file_close(fs, fd2);
 }
 
+void test_map(FAT_FILESYSTEM * fs) {
+	FAT_OPEN_FILE *fd1;
+	FAT_FILE_VIEW *view;
+	char buffer[4096];
+
+	fd1 = mini_file_open(fs, "file1.txt", false);
+
+	printf("Mapping the 2nd line of the file.\n");
+	view = mini_file_map(fs, fd1, 45, 45);
+	score(view != NULL);
+	score(view != NULL && view->size == 45 && strncmp(view->data, "The slowy brown fox jumps over the lazy dog.\n", 45) == 0);
+	mini_file_unmap(view);
+
+	printf("Mapping the whole file should match reading it.\n");
+	int size = mini_file_size(fs, "file1.txt");
+	memset(buffer, 0, sizeof(buffer));
+	mini_file_seek(fs, fd1, 0, true);
+	mini_file_read(fs, fd1, size, buffer);
+	view = mini_file_map(fs, fd1, 0, size);
+	score(view != NULL && memcmp(view->data, buffer, size) == 0);
+	mini_file_unmap(view);
+
+	printf("Mapping past the end of the file should fail:\n");
+	score(mini_file_map(fs, fd1, size - 10, 11) == NULL);
+
+	printf("The disk should not be resized while a view into it is mapped:\n");
+	view = mini_file_map(fs, fd1, 0, size);
+	score(view != NULL && !view->is_copy && !mini_fat_resize(fs, fs->block_count + 1) && fd1->file->mapped_views == 1);
+	mini_file_unmap(view);
+	score(fd1->file->mapped_views == 0);
+
+	mini_file_close(fs, fd1);
+}
+
+void test_preallocate(FAT_FILESYSTEM * fs) {
+	FAT_OPEN_FILE *fd1;
+	char buffer[2048];
+	int read;
+
+	printf("Preallocating 2 blocks should not change the file size.\n");
+	fd1 = mini_file_open(fs, "file4.txt", true);
+	score(mini_file_preallocate(fs, fd1, 2 * fs->block_size));
+	score(mini_file_size(fs, "file4.txt") == 0);
+	std::vector<int> blocks = fd1->file->block_ids;
+	score(blocks.size() == 2 && blocks[1] == blocks[0] + 1);
+
+	printf("Writing inside the preallocated blocks should not allocate.\n");
+	memset(buffer, 'x', sizeof(buffer));
+	score(mini_file_write(fs, fd1, 1500, buffer) == 1500);
+	score(fd1->file->block_ids == blocks);
+	score(mini_file_size(fs, "file4.txt") == 1500);
+
+	mini_file_seek(fs, fd1, 0, true);
+	memset(buffer, 0, sizeof(buffer));
+	read = mini_file_read(fs, fd1, sizeof(buffer), buffer);
+	score(read == 1500 && buffer[0] == 'x' && buffer[1499] == 'x');
+
+	mini_file_close(fs, fd1);
+	score(mini_file_delete(fs, "file4.txt"));
+}
+
+void test_copy(FAT_FILESYSTEM * fs) {
+	FAT_OPEN_FILE *fd1, *fd2;
+	char buffer[4096], copy[4096];
+	int size = mini_file_size(fs, "file1.txt");
+
+	fd1 = mini_file_open(fs, "file1.txt", false);
+	memset(buffer, 0, sizeof(buffer));
+	mini_file_read(fs, fd1, size, buffer);
+
+	printf("Copying 'file1.txt' to a new file inside the disk.\n");
+	mini_file_seek(fs, fd1, 0, true);
+	fd2 = mini_file_open(fs, "file5.txt", true);
+	score(mini_file_copy(fs, fd1, fd2, size) == size);
+	score(mini_file_size(fs, "file5.txt") == size);
+	mini_file_seek(fs, fd2, 0, true);
+	memset(copy, 0, sizeof(copy));
+	score(mini_file_read(fs, fd2, size, copy) == size && memcmp(copy, buffer, size) == 0);
+	mini_file_close(fs, fd2);
+	mini_file_delete(fs, "file5.txt");
+
+	printf("Copying 'file1.txt' to a host file and back.\n");
+	FILE * host = tmpfile();
+	mini_file_seek(fs, fd1, 0, true);
+	score(mini_file_copy_to_fd(fs, fd1, fileno(host), size) == size);
+	memset(copy, 0, sizeof(copy));
+	score(pread(fileno(host), copy, size, 0) == size && memcmp(copy, buffer, size) == 0);
+
+	lseek(fileno(host), 0, SEEK_SET);
+	fd2 = mini_file_open(fs, "file5.txt", true);
+	score(mini_file_copy_from_fd(fs, fd2, fileno(host), size) == size);
+	mini_file_seek(fs, fd2, 0, true);
+	memset(copy, 0, sizeof(copy));
+	score(mini_file_read(fs, fd2, size, copy) == size && memcmp(copy, buffer, size) == 0);
+	mini_file_close(fs, fd2);
+	mini_file_delete(fs, "file5.txt");
+
+	printf("Copying from a host file shorter than asked should not keep extra blocks.\n");
+	lseek(fileno(host), 0, SEEK_SET);
+	fd2 = mini_file_open(fs, "file5.txt", true);
+	score(mini_file_copy_from_fd(fs, fd2, fileno(host), size + 8 * fs->block_size) == size
+		&& (int)fd2->file->block_ids.size() == (size + fs->block_size - 1) / fs->block_size);
+	score(mini_file_copy_from_fd(fs, fd2, fileno(host), INT_MAX) == 0 && mini_file_size(fs, "file5.txt") == size);
+	mini_file_close(fs, fd2);
+	mini_file_delete(fs, "file5.txt");
+	fclose(host);
+
+	mini_file_close(fs, fd1);
+}
+
 void test_suite(FAT_FILESYSTEM * fs) {
 	test_open_3_files(fs);
 	test_delete_file2(fs);
@@ -292,6 +838,9 @@ void test_suite(FAT_FILESYSTEM * fs) {
 	test_read_from_file1(fs);
 
 	test_seek(fs);
+	test_map(fs);
+	test_preallocate(fs);
+	test_copy(fs);
 
 	mini_fat_dump(fs);
 }
@@ -303,6 +852,25 @@ int main()
 	FAT_FILESYSTEM * fs = mini_fat_create("fs1.fat", 1024, 10);
 
 	test_small_filesystem(mini_fat_create("temp.fat", 128, 3)); // Only 3 blocks, 1 metadata, 2 files.
+	test_inline(mini_fat_create("inline.fat", 256, 8));
+	test_discard(mini_fat_create("discard.fat", 4096, 32));
+	test_resize(mini_fat_create("resize.fat", 1024, 16));
+	test_resize_metadata(mini_fat_create("resize.fat", 128, 300));
+	std::vector<const char *> stripes;
+	stripes.push_back("stripe0.fat");
+	stripes.push_back("stripe1.fat");
+	stripes.push_back("stripe2.fat");
+	test_striped(stripes);
+	std::vector<const char *> mirrors;
+	mirrors.push_back("mirror0.fat");
+	mirrors.push_back("mirror1.fat");
+	test_mirrored(mirrors);
+	test_log_structured(mini_fat_create("log.fat", 1024, 48));
+	test_allocation_groups(mini_fat_create("groups.fat", 1024, 128));
+	test_direct_io(mini_fat_create("direct.fat", 300, 40));
+	test_batch(mini_fat_create("batch.fat", 256, 64));
+	test_snapshot(mini_fat_create("snap.fat", 1024, 32));
+	test_snapshot_many_files(mini_fat_create("snap.fat", 256, 256));
 
 	test_suite(fs);
 
@@ -322,7 +890,7 @@ int main()
 	}
 
 
-	printf("Final score: %d/%d\n", current_score/3*2, 100);
+	printf("Final score: %d/%d\n", current_score * 100 / total_score, 100);
 	return 0;
 }
 
@@ -0,0 +1,64 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "geometry.h"
+
+// Physical and logical addresses are printed as ints.
+#define MAX_SPACE 0x40000000
+
+void geometry_defaults(struct geometry *geometry) {
+    memset(geometry, 0, sizeof(struct geometry));
+    geometry->tlb_size = DEFAULT_TLB_SIZE;
+    geometry->tlb_ways = DEFAULT_TLB_WAYS;
+    geometry->pages = DEFAULT_PAGES;
+    geometry->frames = DEFAULT_FRAMES;
+    geometry->page_size = DEFAULT_PAGE_SIZE;
+}
+
+int geometry_option(struct geometry *geometry, const char *option, const char *value) {
+    if (!strcmp(option, "-t"))
+        geometry->tlb_size = atoi(value);
+    else if (!strcmp(option, "-w"))
+        geometry->tlb_ways = atoi(value);
+    else if (!strcmp(option, "-n"))
+        geometry->pages = atoi(value);
+    else if (!strcmp(option, "-f"))
+        geometry->frames = atoi(value);
+    else if (!strcmp(option, "-s"))
+        geometry->page_size = atoi(value);
+    else
+        return 0;
+    return 1;
+}
+
+static int is_pow2(int value) {
+    return (value & (value - 1)) == 0;
+}
+
+int geometry_init(struct geometry *geometry) {
+    if (geometry->tlb_size < 1 || geometry->pages < 1 || geometry->page_size < 1 ||
+        geometry->frames < 1 || geometry->frames > geometry->pages) {
+        fprintf(stderr, "Sizes must be positive, with at most as many frames as pages\n");
+        return 0;
+    }
+    if (geometry->tlb_ways < 0 || (geometry->tlb_ways > 0 && geometry->tlb_size % geometry->tlb_ways != 0)) {
+        fprintf(stderr, "The TLB size must be a multiple of its number of ways\n");
+        return 0;
+    }
+    if ((long)geometry->pages * geometry->page_size > MAX_SPACE) {
+        fprintf(stderr, "The logical address space cannot exceed %d bytes\n", MAX_SPACE);
+        return 0;
+    }
+
+    geometry->pow2 = is_pow2(geometry->page_size) && is_pow2(geometry->pages);
+    if (geometry->pow2) {
+        geometry->offset_bits = 0;
+        while ((1 << geometry->offset_bits) < geometry->page_size) {
+            geometry->offset_bits++;
+        }
+        geometry->offset_mask = geometry->page_size - 1;
+        geometry->page_mask = (uint64_t)(geometry->pages - 1) << geometry->offset_bits;
+    }
+    return 1;
+}
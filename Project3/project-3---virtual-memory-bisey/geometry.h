@@ -0,0 +1,61 @@
+#ifndef GEOMETRY_H
+#define GEOMETRY_H
+
+#include <stdint.h>
+
+// Sizes of the simulated machine, chosen on the command line. The defaults are those of the assignment: a fully
+// associative TLB of 16 lines, 1024 logical pages, 256 frames and pages of 1024 bytes.
+#define DEFAULT_TLB_SIZE 16
+#define DEFAULT_PAGES 1024
+#define DEFAULT_FRAMES 256
+#define DEFAULT_PAGE_SIZE 1024
+#define DEFAULT_TLB_WAYS 0 // fully associative
+
+// A logical address is split into a logical page number and an offset in that page:
+//   offset = address % page_size, logical page = address / page_size % pages
+// When page_size and pages are both powers of two, which is the usual case, that is the masks and shifts of the
+// original code, and the functions below take that path instead of dividing.
+struct geometry {
+    int tlb_size;
+    int tlb_ways; // associativity of the TLB, 0 for fully associative
+    int pages;
+    int frames;
+    int page_size;
+
+    // Filled by geometry_init.
+    int pow2; // page_size and pages are powers of two, the fields below are valid
+    int offset_bits;
+    uint64_t page_mask;
+    uint64_t offset_mask;
+};
+
+// Sets the default sizes.
+void geometry_defaults(struct geometry *geometry);
+
+// Reads one size option, -t tlb_size, -w tlb_ways, -n pages, -f frames or -s page_size. Returns 0 if option is none
+// of them.
+int geometry_option(struct geometry *geometry, const char *option, const char *value);
+
+// Checks the sizes and computes the masks. Prints an error and returns 0 if they are not usable.
+int geometry_init(struct geometry *geometry);
+
+static inline int geometry_page(const struct geometry *geometry, uint64_t address) {
+    if (geometry->pow2)
+        return (address & geometry->page_mask) >> geometry->offset_bits;
+    return address / geometry->page_size % geometry->pages;
+}
+
+static inline int geometry_offset(const struct geometry *geometry, uint64_t address) {
+    if (geometry->pow2)
+        return address & geometry->offset_mask;
+    return address % geometry->page_size;
+}
+
+// Physical address of an offset in a frame.
+static inline int geometry_address(const struct geometry *geometry, int frame, int offset) {
+    if (geometry->pow2)
+        return (frame << geometry->offset_bits) | offset;
+    return frame * geometry->page_size + offset;
+}
+
+#endif // GEOMETRY_H
@@ -4,18 +4,11 @@
 #include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-#define TLB_SIZE 16
-#define PAGES 1024
-#define PAGE_MASK 0xFFC00
-#define PAGE_SIZE 1024
-#define OFFSET_BITS 10
-#define OFFSET_MASK 0x003FF
-
-#define MEMORY_SIZE PAGES * PAGE_SIZE
-
-// Max number of characters per line of input file to read.
-#define BUFFER_SIZE 10
+#include "geometry.h"
+#include "trace.h"
 
 struct tlbentry {
   unsigned int logical;
@@ -24,15 +17,18 @@ struct tlbentry {
 };
 
 
+// Sizes chosen on the command line. There are as many frames as pages, so the main memory never fills up.
+struct geometry geometry;
+
 // TLB is kept track of as a circular array, with the oldest element being overwritten once the TLB is full.
-struct tlbentry tlb[TLB_SIZE];
-// number of inserts into TLB that have been completed. Use as tlbindex % TLB_SIZE for the index of the next TLB line to use.
+struct tlbentry *tlb;
+// index of the next TLB line to consider for replacement
 int tlbindex = 0;
 
 // pagetable[logical_page] is the physical page number for logical page. Value is -1 if that logical page isn't yet in the table.
-int pagetable[PAGES];
+int *pagetable;
 
-signed char main_memory[MEMORY_SIZE];
+signed char *main_memory;
 
 // Pointer to memory mapped backing file
 signed char *backing;
@@ -45,7 +41,7 @@ int max(int a, int b){
 
 /* Returns the physical address from TLB or -1 if not present. */
 int search_tlb(unsigned int logical_page) {
-  for (int i = 0; i < TLB_SIZE; i++) {
+  for (int i = 0; i < geometry.tlb_size; i++) {
     if (tlb[i].logical == logical_page) {
       tlb[i].reference = 1; // Mark the page as referenced
       return tlb[i].physical;
@@ -61,42 +57,62 @@ void add_to_tlb(unsigned int logical, unsigned int physical) {
         tlb[tlbindex].logical = logical;
         tlb[tlbindex].physical = physical;
         tlb[tlbindex].reference = 1; // Set the reference bit to 1 for the new entry
-        tlbindex = (tlbindex + 1) % TLB_SIZE; // Move to next page
+        tlbindex = (tlbindex + 1) % geometry.tlb_size; // Move to next page
         break;
     } else {
         tlb[tlbindex].reference = 0; // Clear reference bit if it's set
-        tlbindex = (tlbindex + 1) % TLB_SIZE; // Move to next page
+        tlbindex = (tlbindex + 1) % geometry.tlb_size; // Move to next page
     }
   }
 }
 
 int main(int argc, const char *argv[]){
-  if (argc != 3) {
-    fprintf(stderr, "Usage ./virtmem backingstore input\n");
+  geometry_defaults(&geometry);
+  int usage = argc < 3 || argc % 2 == 0;
+  for (int i = 3; !usage && i < argc; i += 2) {
+    usage = !strcmp(argv[i], "-f") || !strcmp(argv[i], "-w") || !geometry_option(&geometry, argv[i], argv[i + 1]);
+  }
+  if (usage) {
+    fprintf(stderr, "Usage ./virtmem backingstore input [-t tlb_size] [-n pages] [-s page_size]\n");
     exit(1);
   }
+  geometry.frames = geometry.pages;
+  if (!geometry_init(&geometry))
+    exit(1);
+  size_t memory_size = (size_t)geometry.pages * geometry.page_size;
+  tlb = malloc(geometry.tlb_size * sizeof(struct tlbentry));
+  pagetable = malloc(geometry.pages * sizeof(int));
+  main_memory = malloc(memory_size);
   
   const char *backing_filename = argv[1]; 
   int backing_fd = open(backing_filename, O_RDONLY);
-  backing = mmap(0, MEMORY_SIZE, PROT_READ, MAP_PRIVATE, backing_fd, 0); 
+  struct stat st;
+  if (backing_fd >= 0 && fstat(backing_fd, &st) == 0 && (size_t)st.st_size < memory_size) {
+    fprintf(stderr, "Backing store %s is smaller than %d pages of %d bytes\n", backing_filename, geometry.pages, geometry.page_size);
+    exit(1);
+  }
+  backing = mmap(0, memory_size, PROT_READ, MAP_PRIVATE, backing_fd, 0); 
+  if (backing == MAP_FAILED) {
+    fprintf(stderr, "Cannot map backing store %s\n", backing_filename);
+    exit(1);
+  }
   
-  const char *input_filename = argv[2];
-  FILE *input_fp = fopen(input_filename, "r");
+  // Text or binary trace of logical addresses.
+  struct trace *trace = trace_open(argv[2]);
+  if (trace == NULL)
+    exit(1);
   
   // Fill page table entries with -1 for initially empty table.
   int i;
-  for (i = 0; i < PAGES; i++) {
+  for (i = 0; i < geometry.pages; i++) {
     pagetable[i] = -1;
   }
-  for (i = 0; i < TLB_SIZE; i++){
+  for (i = 0; i < geometry.tlb_size; i++){
     tlb[i].logical = -1;
     tlb[i].physical = -1;
     tlb[i].reference = 0;
   }
   
-  // Character buffer for reading lines of input file.
-  char buffer[BUFFER_SIZE];
-  
   // Data we need to keep track of to compute stats at end.
   int total_addresses = 0;
   int tlb_hits = 0;
@@ -105,14 +121,15 @@ int main(int argc, const char *argv[]){
   // Number of the next unallocated physical page in main memory
   unsigned int free_page = 0;
   
-  while (fgets(buffer, BUFFER_SIZE, input_fp) != NULL) {
+  uint64_t address;
+  while (trace_next(trace, &address)) {
     total_addresses++;
-    int logical_address = atoi(buffer);
+    int logical_address = address;
 
     /* TODO 
     / Calculate the page offset and logical page number from logical_address */
-    int offset = logical_address & OFFSET_MASK; // offset is given at the rightmost 10 bits
-    int logical_page = (logical_address & PAGE_MASK) >> OFFSET_BITS; // page number is given at the rightmost 10th to 19th bits, shift to right by OFFSET_BITS to get the actual value
+    int offset = geometry_offset(&geometry, address); // offset is given at the rightmost 10 bits with the default page size
+    int logical_page = geometry_page(&geometry, address); // page number is given at the rightmost 10th to 19th bits with the default sizes
     ///////
 
 
@@ -131,7 +148,7 @@ int main(int argc, const char *argv[]){
           free_page++; // increment free page
 
           // Copy the page from the backing file into physical memory
-          memcpy(main_memory + physical_page*PAGE_SIZE, backing + logical_page*PAGE_SIZE, PAGE_SIZE); // copy the page from the backing file into physical memory at the physical page number multiplied by the page size
+          memcpy(main_memory + (size_t)physical_page*geometry.page_size, backing + (size_t)logical_page*geometry.page_size, geometry.page_size); // copy the page from the backing file into physical memory at the physical page number multiplied by the page size
 
           // Update the page table
           pagetable[logical_page] = physical_page; // update the page table to map the logical page to the physical page
@@ -141,8 +158,8 @@ int main(int argc, const char *argv[]){
       add_to_tlb(logical_page, physical_page);
     }
     
-    int physical_address = (physical_page << OFFSET_BITS) | offset;
-    signed char value = main_memory[physical_page * PAGE_SIZE + offset];
+    int physical_address = geometry_address(&geometry, physical_page, offset);
+    signed char value = main_memory[(size_t)physical_page * geometry.page_size + offset];
     printf("Accessing logical: %d\n", logical_page);
     printf("Virtual address: %d Physical address: %d Value: %d\n", logical_address, physical_address, value);
   }
@@ -153,5 +170,9 @@ int main(int argc, const char *argv[]){
   printf("TLB Hits = %d\n", tlb_hits);
   printf("TLB Hit Rate = %.3f\n", tlb_hits / (1. * total_addresses));
   
+  trace_close(trace);
+  free(tlb);
+  free(pagetable);
+  free(main_memory);
   return 0;
 }
\ No newline at end of file
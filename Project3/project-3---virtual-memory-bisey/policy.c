@@ -0,0 +1,707 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "policy.h"
+
+// Every policy state starts with this header. It holds the geometry, and the arrays allocated for the state with
+// new_block, so destroy_policy_state frees any state.
+#define MAX_STATE_BLOCKS 8
+
+struct state_header {
+    int frames;
+    int pages;
+    void *blocks[MAX_STATE_BLOCKS];
+    int block_count;
+};
+
+static void *new_state(size_t size, int frames, int pages) {
+    struct state_header *header = calloc(1, size);
+    header->frames = frames;
+    header->pages = pages;
+    return header;
+}
+
+static void *new_block(struct state_header *header, size_t size) {
+    void *block = calloc(1, size);
+    header->blocks[header->block_count++] = block;
+    return block;
+}
+
+static int *new_array(struct state_header *header, int size, int value) {
+    int *array = new_block(header, size * sizeof(int));
+    for (int i = 0; i < size; i++) {
+        array[i] = value;
+    }
+    return array;
+}
+
+void destroy_policy_state(void *state) {
+    struct state_header *header = state;
+    for (int i = 0; i < header->block_count; i++) {
+        free(header->blocks[i]);
+    }
+    free(header);
+}
+
+// Doubly linked lists over indexes (frames or pages). The links live in arrays indexed by the element, shared by all
+// the lists of a policy, so an element can be moved between lists in O(1). An element is in at most one list.
+struct links {
+    int *prev;
+    int *next;
+};
+
+struct list {
+    int head; // most recently inserted element, or -1
+    int tail; // least recently inserted element, or -1
+    int size;
+};
+
+static void links_init(struct state_header *header, struct links *links, int size) {
+    links->prev = new_array(header, size, -1);
+    links->next = new_array(header, size, -1);
+}
+
+static void list_init(struct list *list) {
+    list->head = -1;
+    list->tail = -1;
+    list->size = 0;
+}
+
+static void list_push_front(struct list *list, struct links *links, int element) {
+    links->prev[element] = -1;
+    links->next[element] = list->head;
+    if (list->head != -1)
+        links->prev[list->head] = element;
+    else
+        list->tail = element;
+    list->head = element;
+    list->size++;
+}
+
+static void list_remove(struct list *list, struct links *links, int element) {
+    if (links->prev[element] != -1)
+        links->next[links->prev[element]] = links->next[element];
+    else
+        list->head = links->next[element];
+    if (links->next[element] != -1)
+        links->prev[links->next[element]] = links->prev[element];
+    else
+        list->tail = links->prev[element];
+    links->prev[element] = -1;
+    links->next[element] = -1;
+    list->size--;
+}
+
+static int list_pop_back(struct list *list, struct links *links) {
+    int element = list->tail;
+    list_remove(list, links, element);
+    return element;
+}
+
+// Binary min-heap of frames ordered by key[frame]. index[frame] locates a frame in it, or is -1, so the key of a
+// frame can change in place in O(log frames).
+struct heap {
+    int *frames;
+    int *index;
+    long *key;
+    int size;
+};
+
+static void heap_init(struct state_header *header, struct heap *heap, int size) {
+    heap->frames = new_array(header, size, -1);
+    heap->index = new_array(header, size, -1);
+    heap->key = new_block(header, size * sizeof(long));
+    heap->size = 0;
+}
+
+static void heap_swap(struct heap *heap, int i, int j) {
+    int frame = heap->frames[i];
+    heap->frames[i] = heap->frames[j];
+    heap->frames[j] = frame;
+    heap->index[heap->frames[i]] = i;
+    heap->index[heap->frames[j]] = j;
+}
+
+static void heap_sift(struct heap *heap, int i) {
+    while (i > 0 && heap->key[heap->frames[i]] < heap->key[heap->frames[(i - 1) / 2]]) {
+        heap_swap(heap, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+    while (1) {
+        int smallest = i;
+        int left = 2 * i + 1, right = 2 * i + 2;
+        if (left < heap->size && heap->key[heap->frames[left]] < heap->key[heap->frames[smallest]])
+            smallest = left;
+        if (right < heap->size && heap->key[heap->frames[right]] < heap->key[heap->frames[smallest]])
+            smallest = right;
+        if (smallest == i)
+            return;
+        heap_swap(heap, i, smallest);
+        i = smallest;
+    }
+}
+
+static void heap_push(struct heap *heap, int frame, long key) {
+    heap->key[frame] = key;
+    heap->frames[heap->size] = frame;
+    heap->index[frame] = heap->size++;
+    heap_sift(heap, heap->index[frame]);
+}
+
+static void heap_update(struct heap *heap, int frame, long key) {
+    heap->key[frame] = key;
+    heap_sift(heap, heap->index[frame]);
+}
+
+// Removes and returns the frame with the smallest key.
+static int heap_pop(struct heap *heap) {
+    int frame = heap->frames[0];
+    heap_swap(heap, 0, --heap->size);
+    heap_sift(heap, 0);
+    heap->index[frame] = -1;
+    return frame;
+}
+
+static void ignore_access(void *state, int page, int frame) {
+}
+
+/* FIFO: evict the page that was loaded first. Every victim is refilled at once, so the frames are evicted in a round
+ * robin starting from frame 0, the first one filled. */
+struct fifo {
+    struct state_header header;
+    int next;
+};
+
+static void *fifo_create(int frames, int pages) {
+    return new_state(sizeof(struct fifo), frames, pages);
+}
+
+static int fifo_choose_victim(void *state, int page) {
+    struct fifo *fifo = state;
+    int frame = fifo->next;
+    fifo->next = (fifo->next + 1) % fifo->header.frames;
+    return frame;
+}
+
+/* Clock (second chance): frames are swept in a circle; a referenced frame loses its reference bit and is skipped
+ * once, the first frame found without it is evicted. */
+struct clock {
+    struct state_header header;
+    int *reference;
+    int hand;
+};
+
+static void *clock_create(int frames, int pages) {
+    struct clock *clock = new_state(sizeof(struct clock), frames, pages);
+    clock->reference = new_array(&clock->header, frames, 0);
+    return clock;
+}
+
+static void clock_on_access(void *state, int page, int frame) {
+    struct clock *clock = state;
+    clock->reference[frame] = 1;
+}
+
+static int clock_choose_victim(void *state, int page) {
+    struct clock *clock = state;
+    while (clock->reference[clock->hand]) {
+        clock->reference[clock->hand] = 0; // give it a second chance
+        clock->hand = (clock->hand + 1) % clock->header.frames;
+    }
+    int frame = clock->hand;
+    clock->hand = (clock->hand + 1) % clock->header.frames;
+    return frame;
+}
+
+/* LRU: evict the least recently used frame. Frames are kept in a recency list, most recently used first; a
+ * reference moves the frame to the front and the victim is the tail, both in O(1). */
+struct lru {
+    struct state_header header;
+    struct links links;
+    struct list list;
+};
+
+static void *lru_create(int frames, int pages) {
+    struct lru *lru = new_state(sizeof(struct lru), frames, pages);
+    links_init(&lru->header, &lru->links, frames);
+    list_init(&lru->list);
+    return lru;
+}
+
+static void lru_on_access(void *state, int page, int frame) {
+    struct lru *lru = state;
+    list_remove(&lru->list, &lru->links, frame);
+    list_push_front(&lru->list, &lru->links, frame);
+}
+
+static void lru_on_fault(void *state, int page, int frame) {
+    struct lru *lru = state;
+    list_push_front(&lru->list, &lru->links, frame);
+}
+
+static int lru_choose_victim(void *state, int page) {
+    struct lru *lru = state;
+    return list_pop_back(&lru->list, &lru->links);
+}
+
+/* LFU: evict the frame referenced the fewest times since it was loaded, the least recently used one among equals.
+ * The heap key packs the count above the time of the last reference. */
+struct lfu {
+    struct state_header header;
+    struct heap heap;
+    int *count;
+    long clock;
+};
+
+static long lfu_key(struct lfu *lfu, int frame) {
+    return ((long)lfu->count[frame] << 32) | (lfu->clock++ & 0xFFFFFFFF);
+}
+
+static void *lfu_create(int frames, int pages) {
+    struct lfu *lfu = new_state(sizeof(struct lfu), frames, pages);
+    heap_init(&lfu->header, &lfu->heap, frames);
+    lfu->count = new_array(&lfu->header, frames, 0);
+    return lfu;
+}
+
+static void lfu_on_access(void *state, int page, int frame) {
+    struct lfu *lfu = state;
+    lfu->count[frame]++;
+    heap_update(&lfu->heap, frame, lfu_key(lfu, frame));
+}
+
+static void lfu_on_fault(void *state, int page, int frame) {
+    struct lfu *lfu = state;
+    lfu->count[frame] = 1;
+    heap_push(&lfu->heap, frame, lfu_key(lfu, frame));
+}
+
+static int lfu_choose_victim(void *state, int page) {
+    struct lfu *lfu = state;
+    return heap_pop(&lfu->heap);
+}
+
+/* OPT (Belady): evict the page whose next reference is the farthest in the future, or that is never referenced
+ * again. It needs the whole trace: prepare finds the next reference of every position in one backward pass, and
+ * resident frames sit in a heap keyed by the negated position of their next reference, so the run is O(n log F). */
+struct opt {
+    struct state_header header;
+    struct heap heap;
+    size_t *next; // next[i] is the position of the next reference to the page of position i, or count
+    size_t position; // position of the current reference
+};
+
+static void *opt_create(int frames, int pages) {
+    struct opt *opt = new_state(sizeof(struct opt), frames, pages);
+    heap_init(&opt->header, &opt->heap, frames);
+    return opt;
+}
+
+static void opt_prepare(void *state, const int *pages, size_t count) {
+    struct opt *opt = state;
+    size_t *last = malloc(opt->header.pages * sizeof(size_t));
+    for (int i = 0; i < opt->header.pages; i++) {
+        last[i] = count;
+    }
+    opt->next = new_block(&opt->header, (count > 0 ? count : 1) * sizeof(size_t));
+    for (size_t i = count; i-- > 0;) {
+        opt->next[i] = last[pages[i]];
+        last[pages[i]] = i;
+    }
+    free(last);
+}
+
+static void opt_on_access(void *state, int page, int frame) {
+    struct opt *opt = state;
+    heap_update(&opt->heap, frame, -(long)opt->next[opt->position++]);
+}
+
+static void opt_on_fault(void *state, int page, int frame) {
+    struct opt *opt = state;
+    heap_push(&opt->heap, frame, -(long)opt->next[opt->position++]);
+}
+
+static int opt_choose_victim(void *state, int page) {
+    struct opt *opt = state;
+    return heap_pop(&opt->heap);
+}
+
+/* 2Q (Johnson and Shasha, full version): a page seen for the first time enters A1in, a FIFO of a quarter of the
+ * frames. Pages evicted from A1in are remembered, without their contents, in A1out, a FIFO of half as many pages as
+ * there are frames. A page that faults again while in A1out has proved it is reused and enters Am, an LRU list. The
+ * victim comes from A1in while it holds more than its share, from Am otherwise. */
+#define TWOQ_NONE 0
+#define TWOQ_A1IN 1
+#define TWOQ_A1OUT 2
+#define TWOQ_AM 3
+
+struct twoq {
+    struct state_header header;
+    int *where; // TWOQ_* list of each page
+    int *frame; // frame of each resident page
+    struct links links;
+    struct list a1in, a1out, am;
+    int kin, kout;
+};
+
+static void *twoq_create(int frames, int pages) {
+    struct twoq *twoq = new_state(sizeof(struct twoq), frames, pages);
+    twoq->where = new_array(&twoq->header, pages, TWOQ_NONE);
+    twoq->frame = new_array(&twoq->header, pages, -1);
+    links_init(&twoq->header, &twoq->links, pages);
+    list_init(&twoq->a1in);
+    list_init(&twoq->a1out);
+    list_init(&twoq->am);
+    twoq->kin = frames / 4 > 0 ? frames / 4 : 1;
+    twoq->kout = frames / 2 > 0 ? frames / 2 : 1;
+    return twoq;
+}
+
+static void twoq_on_access(void *state, int page, int frame) {
+    struct twoq *twoq = state;
+    if (twoq->where[page] == TWOQ_AM) { // A1in is a FIFO, references there do not reorder it
+        list_remove(&twoq->am, &twoq->links, page);
+        list_push_front(&twoq->am, &twoq->links, page);
+    }
+}
+
+static void twoq_on_fault(void *state, int page, int frame) {
+    struct twoq *twoq = state;
+    twoq->frame[page] = frame;
+    if (twoq->where[page] == TWOQ_A1OUT) {
+        list_remove(&twoq->a1out, &twoq->links, page);
+        list_push_front(&twoq->am, &twoq->links, page);
+        twoq->where[page] = TWOQ_AM;
+    } else {
+        list_push_front(&twoq->a1in, &twoq->links, page);
+        twoq->where[page] = TWOQ_A1IN;
+    }
+}
+
+static int twoq_choose_victim(void *state, int page) {
+    struct twoq *twoq = state;
+    int victim;
+    if (twoq->a1in.size > twoq->kin || twoq->am.size == 0) {
+        victim = list_pop_back(&twoq->a1in, &twoq->links);
+        list_push_front(&twoq->a1out, &twoq->links, victim);
+        twoq->where[victim] = TWOQ_A1OUT;
+        // A page faulting back in from the tail of A1out is not forgotten: twoq_on_fault takes it to Am, which
+        // brings A1out back to its size anyway.
+        if (twoq->a1out.size > twoq->kout && twoq->a1out.tail != page)
+            twoq->where[list_pop_back(&twoq->a1out, &twoq->links)] = TWOQ_NONE;
+    } else {
+        victim = list_pop_back(&twoq->am, &twoq->links);
+        twoq->where[victim] = TWOQ_NONE;
+    }
+    return twoq->frame[victim];
+}
+
+/* ARC (Megiddo and Modha): resident pages are split between T1, seen once recently, and T2, seen at least twice,
+ * both LRU lists. B1 and B2 remember the pages last evicted from each, without their contents. A fault on a page of
+ * B1 means T1 was too small, one on B2 that T2 was; the target size p of T1 moves accordingly, and decides which list
+ * the victim comes from. */
+#define ARC_NONE 0
+#define ARC_T1 1
+#define ARC_T2 2
+#define ARC_B1 3
+#define ARC_B2 4
+
+struct arc {
+    struct state_header header;
+    int *where; // ARC_* list of each page
+    int *frame; // frame of each resident page
+    struct links links;
+    struct list lists[5]; // indexed by ARC_*, ARC_NONE unused
+    int p; // target size of T1
+};
+
+static void *arc_create(int frames, int pages) {
+    struct arc *arc = new_state(sizeof(struct arc), frames, pages);
+    arc->where = new_array(&arc->header, pages, ARC_NONE);
+    arc->frame = new_array(&arc->header, pages, -1);
+    links_init(&arc->header, &arc->links, pages);
+    for (int i = 0; i < 5; i++) {
+        list_init(&arc->lists[i]);
+    }
+    return arc;
+}
+
+static void arc_move(struct arc *arc, int page, int where) {
+    if (arc->where[page] != ARC_NONE)
+        list_remove(&arc->lists[arc->where[page]], &arc->links, page);
+    if (where != ARC_NONE)
+        list_push_front(&arc->lists[where], &arc->links, page);
+    arc->where[page] = where;
+}
+
+static void arc_on_access(void *state, int page, int frame) {
+    arc_move(state, page, ARC_T2);
+}
+
+static void arc_on_fault(void *state, int page, int frame) {
+    struct arc *arc = state;
+    arc->frame[page] = frame;
+    // A page remembered by a ghost list has been used twice recently.
+    arc_move(arc, page, arc->where[page] == ARC_B1 || arc->where[page] == ARC_B2 ? ARC_T2 : ARC_T1);
+}
+
+// Evict the LRU page of T1 or T2 into the matching ghost list, as REPLACE does in the paper.
+static int arc_replace(struct arc *arc, int page) {
+    int t1 = arc->lists[ARC_T1].size;
+    int from_t1 = t1 > 0 && ((arc->where[page] == ARC_B2 && t1 == arc->p) || t1 > arc->p);
+    if (arc->lists[ARC_T2].size == 0)
+        from_t1 = 1;
+    int victim = arc->lists[from_t1 ? ARC_T1 : ARC_T2].tail;
+    arc_move(arc, victim, from_t1 ? ARC_B1 : ARC_B2);
+    return arc->frame[victim];
+}
+
+static int arc_choose_victim(void *state, int page) {
+    struct arc *arc = state;
+    int frames = arc->header.frames;
+    int t1 = arc->lists[ARC_T1].size, t2 = arc->lists[ARC_T2].size;
+    int b1 = arc->lists[ARC_B1].size, b2 = arc->lists[ARC_B2].size;
+    if (arc->where[page] == ARC_B1) {
+        int delta = b1 >= b2 ? 1 : b2 / b1;
+        arc->p = arc->p + delta < frames ? arc->p + delta : frames;
+        return arc_replace(arc, page);
+    }
+    if (arc->where[page] == ARC_B2) {
+        int delta = b2 >= b1 ? 1 : b1 / b2;
+        arc->p = arc->p - delta > 0 ? arc->p - delta : 0;
+        return arc_replace(arc, page);
+    }
+    // A new page: keep T1 + B1 and the whole directory within their bounds.
+    if (t1 + b1 >= frames) {
+        if (t1 < frames) {
+            arc_move(arc, arc->lists[ARC_B1].tail, ARC_NONE);
+            return arc_replace(arc, page);
+        }
+        int victim = arc->lists[ARC_T1].tail; // B1 is empty, T1 fills the memory: forget its LRU page
+        arc_move(arc, victim, ARC_NONE);
+        return arc->frame[victim];
+    }
+    if (t1 + t2 + b1 + b2 >= 2 * frames)
+        arc_move(arc, arc->lists[ARC_B2].tail, ARC_NONE);
+    return arc_replace(arc, page);
+}
+
+/* CLOCK-Pro (Jiang, Chen and Zhang), in the simplified form with one circular list and three hands. Resident pages
+ * are hot or cold; a cold page that is evicted stays in the list as a non-resident test page for a while, and a fault
+ * on it makes the page hot and grows cold_target, the number of frames for cold pages. Only cold pages are evicted:
+ * hand_cold turns referenced cold pages hot and evicts the others, hand_hot turns unreferenced hot pages cold when
+ * there are too many hot pages, and hand_test ends test periods, shrinking cold_target. Pages enter the list right
+ * behind hand_hot. */
+#define CLOCKPRO_NONE 0
+#define CLOCKPRO_HOT 1
+#define CLOCKPRO_COLD 2
+#define CLOCKPRO_TEST 3
+
+struct clockpro {
+    struct state_header header;
+    int *state; // CLOCKPRO_* state of each page
+    int *reference;
+    int *frame;
+    int *prev; // circular list of the pages
+    int *next;
+    int hand_hot, hand_cold, hand_test;
+    int hot, cold, test; // number of pages in each state
+    int cold_target;
+    int promoted; // page whose fault was a test hit, to be inserted hot
+};
+
+static void *clockpro_create(int frames, int pages) {
+    struct clockpro *clockpro = new_state(sizeof(struct clockpro), frames, pages);
+    clockpro->state = new_array(&clockpro->header, pages, CLOCKPRO_NONE);
+    clockpro->reference = new_array(&clockpro->header, pages, 0);
+    clockpro->frame = new_array(&clockpro->header, pages, -1);
+    clockpro->prev = new_array(&clockpro->header, pages, -1);
+    clockpro->next = new_array(&clockpro->header, pages, -1);
+    clockpro->hand_hot = clockpro->hand_cold = clockpro->hand_test = -1;
+    clockpro->cold_target = frames;
+    clockpro->promoted = -1;
+    return clockpro;
+}
+
+// Insert a page right behind hand_hot, the position of the most recent pages.
+static void clockpro_insert(struct clockpro *clockpro, int page, int state) {
+    clockpro->state[page] = state;
+    clockpro->reference[page] = 0;
+    if (clockpro->hand_hot == -1) {
+        clockpro->prev[page] = clockpro->next[page] = page;
+        clockpro->hand_hot = clockpro->hand_cold = clockpro->hand_test = page;
+        return;
+    }
+    int before = clockpro->prev[clockpro->hand_hot];
+    clockpro->prev[page] = before;
+    clockpro->next[page] = clockpro->hand_hot;
+    clockpro->next[before] = page;
+    clockpro->prev[clockpro->hand_hot] = page;
+    if (clockpro->hand_cold == clockpro->hand_hot)
+        clockpro->hand_cold = page;
+}
+
+// Remove a page from the list; hands pointing to it step back, so their next move lands on its successor.
+static void clockpro_remove(struct clockpro *clockpro, int page) {
+    int prev = clockpro->prev[page];
+    int next = clockpro->next[page];
+    clockpro->state[page] = CLOCKPRO_NONE;
+    if (next == page) {
+        clockpro->hand_hot = clockpro->hand_cold = clockpro->hand_test = -1;
+        return;
+    }
+    if (clockpro->hand_hot == page)
+        clockpro->hand_hot = prev;
+    if (clockpro->hand_cold == page)
+        clockpro->hand_cold = prev;
+    if (clockpro->hand_test == page)
+        clockpro->hand_test = prev;
+    clockpro->next[prev] = next;
+    clockpro->prev[next] = prev;
+}
+
+static void clockpro_run_hand_test(struct clockpro *clockpro) {
+    int page = clockpro->hand_test;
+    if (clockpro->state[page] == CLOCKPRO_TEST) {
+        clockpro_remove(clockpro, page);
+        clockpro->test--;
+        if (clockpro->cold_target > 1)
+            clockpro->cold_target--; // the test period ended without a fault
+    }
+    clockpro->hand_test = clockpro->next[clockpro->hand_test];
+}
+
+static void clockpro_run_hand_hot(struct clockpro *clockpro) {
+    if (clockpro->hand_hot == clockpro->hand_test)
+        clockpro_run_hand_test(clockpro);
+    int page = clockpro->hand_hot;
+    if (clockpro->state[page] == CLOCKPRO_HOT) {
+        if (clockpro->reference[page]) {
+            clockpro->reference[page] = 0;
+        } else {
+            clockpro->state[page] = CLOCKPRO_COLD;
+            clockpro->hot--;
+            clockpro->cold++;
+        }
+    }
+    clockpro->hand_hot = clockpro->next[clockpro->hand_hot];
+}
+
+// Move hand_cold by one page. Returns the page it evicted, or -1.
+static int clockpro_run_hand_cold(struct clockpro *clockpro) {
+    int page = clockpro->hand_cold;
+    int victim = -1;
+    if (clockpro->state[page] == CLOCKPRO_COLD) {
+        if (clockpro->reference[page]) {
+            clockpro->reference[page] = 0;
+            clockpro->state[page] = CLOCKPRO_HOT;
+            clockpro->cold--;
+            clockpro->hot++;
+        } else {
+            clockpro->state[page] = CLOCKPRO_TEST;
+            clockpro->cold--;
+            clockpro->test++;
+            victim = page;
+            while (clockpro->test > clockpro->header.frames)
+                clockpro_run_hand_test(clockpro);
+        }
+    }
+    clockpro->hand_cold = clockpro->next[clockpro->hand_cold];
+    while (clockpro->header.frames - clockpro->cold_target < clockpro->hot)
+        clockpro_run_hand_hot(clockpro);
+    return victim;
+}
+
+static void clockpro_on_access(void *state, int page, int frame) {
+    struct clockpro *clockpro = state;
+    clockpro->reference[page] = 1;
+}
+
+// A fault on a test page ends its test period early: the page becomes hot and cold pages get one more frame.
+static void clockpro_test_hit(struct clockpro *clockpro, int page) {
+    if (clockpro->state[page] != CLOCKPRO_TEST)
+        return;
+    if (clockpro->cold_target < clockpro->header.frames)
+        clockpro->cold_target++;
+    clockpro_remove(clockpro, page);
+    clockpro->test--;
+    clockpro->promoted = page;
+}
+
+static void clockpro_on_fault(void *state, int page, int frame) {
+    struct clockpro *clockpro = state;
+    clockpro_test_hit(clockpro, page);
+    clockpro->frame[page] = frame;
+    if (clockpro->promoted == page) {
+        clockpro_insert(clockpro, page, CLOCKPRO_HOT);
+        clockpro->hot++;
+    } else {
+        clockpro_insert(clockpro, page, CLOCKPRO_COLD);
+        clockpro->cold++;
+    }
+    clockpro->promoted = -1;
+}
+
+static int clockpro_choose_victim(void *state, int page) {
+    struct clockpro *clockpro = state;
+    clockpro_test_hit(clockpro, page);
+    int victim = -1;
+    while (victim == -1) {
+        victim = clockpro_run_hand_cold(clockpro);
+    }
+    return clockpro->frame[victim];
+}
+
+/* Random: evict any frame, from a fixed-seed xorshift generator so runs can be repeated. */
+struct random {
+    struct state_header header;
+    unsigned int seed;
+};
+
+static void *random_create(int frames, int pages) {
+    struct random *random = new_state(sizeof(struct random), frames, pages);
+    random->seed = 2463534242u;
+    return random;
+}
+
+static int random_choose_victim(void *state, int page) {
+    struct random *random = state;
+    random->seed ^= random->seed << 13;
+    random->seed ^= random->seed >> 17;
+    random->seed ^= random->seed << 5;
+    return random->seed % random->header.frames;
+}
+
+static const struct policy policies[] = {
+    {"fifo", "first in, first out", fifo_create, ignore_access, ignore_access, fifo_choose_victim, NULL},
+    {"clock", "second chance on a circular sweep of the frames", clock_create, clock_on_access, clock_on_access, clock_choose_victim, NULL},
+    {"lru", "least recently used", lru_create, lru_on_access, lru_on_fault, lru_choose_victim, NULL},
+    {"lfu", "least frequently used since loaded, LRU among equals", lfu_create, lfu_on_access, lfu_on_fault, lfu_choose_victim, NULL},
+    {"2q", "2Q: FIFO for new pages, LRU for pages that returned", twoq_create, twoq_on_access, twoq_on_fault, twoq_choose_victim, NULL},
+    {"arc", "adaptive replacement cache", arc_create, arc_on_access, arc_on_fault, arc_choose_victim, NULL},
+    {"clockpro", "CLOCK-Pro: hot and cold pages with test periods", clockpro_create, clockpro_on_access, clockpro_on_fault, clockpro_choose_victim, NULL},
+    {"random", "a random frame", random_create, ignore_access, ignore_access, random_choose_victim, NULL},
+    {"opt", "Belady's optimal replacement, looks ahead in the trace", opt_create, opt_on_access, opt_on_fault, opt_choose_victim, opt_prepare},
+};
+
+#define POLICY_COUNT (int)(sizeof(policies) / sizeof(policies[0]))
+
+const struct policy *find_policy(const char *name) {
+    // The original command line used -p 0 for second chance and -p 1 for LRU.
+    if (!strcmp(name, "0"))
+        name = "clock";
+    else if (!strcmp(name, "1"))
+        name = "lru";
+    for (int i = 0; i < POLICY_COUNT; i++) {
+        if (!strcmp(policies[i].name, name))
+            return &policies[i];
+    }
+    return NULL;
+}
+
+void print_policies(FILE *fp) {
+    for (int i = 0; i < POLICY_COUNT; i++) {
+        fprintf(fp, "  %-9s %s\n", policies[i].name, policies[i].description);
+    }
+}
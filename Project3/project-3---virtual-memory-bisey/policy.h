@@ -0,0 +1,35 @@
+#ifndef POLICY_H
+#define POLICY_H
+
+#include <stdio.h>
+
+// A page replacement policy. The simulator reports every reference to it and asks it for a victim frame once the
+// main memory is full. Pages are logical page numbers, frames are physical page numbers. A policy keeps all its
+// data in the state returned by create, so several simulations can run side by side, one per thread.
+struct policy {
+    const char *name;
+    const char *description;
+    // Returns the state of a new instance, for a main memory of frames frames and pages logical pages.
+    void *(*create)(int frames, int pages);
+    // A page that is already in memory has been referenced (TLB hit or page table hit).
+    void (*on_access)(void *state, int page, int frame);
+    // A page has been loaded into a frame after a page fault, and is referenced.
+    void (*on_fault)(void *state, int page, int frame);
+    // The main memory is full and page is about to be loaded: pick the frame to evict. The page held by that frame
+    // is considered gone from then on; on_fault follows with the same frame.
+    int (*choose_victim)(void *state, int page);
+    // Offline policies only, NULL otherwise: called before the first reference with the logical page of every
+    // reference of the trace.
+    void (*prepare)(void *state, const int *pages, size_t count);
+};
+
+// Returns the policy with the given name, or NULL. "0" and "1" are kept as aliases of clock and lru.
+const struct policy *find_policy(const char *name);
+
+// Frees a state returned by the create function of any policy.
+void destroy_policy_state(void *state);
+
+// Prints the name and the description of every policy.
+void print_policies(FILE *fp);
+
+#endif // POLICY_H
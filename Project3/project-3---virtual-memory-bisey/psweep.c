@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "geometry.h"
+#include "policy.h"
+#include "sim.h"
+#include "trace.h"
+
+// Longest list given to -p, -f, -t or -w.
+#define MAX_VALUES 64
+
+/* Parallel sweep: runs part2's translation for every combination of policy, number of frames, TLB size and TLB
+ * associativity (fully associative unless -w is given), and prints
+ * one CSV line per configuration. The trace is read once into an array of logical pages shared by all the threads;
+ * each configuration gets its own simulator, so the workers share nothing else. Only the translation is simulated,
+ * the memory contents are left out since they do not change the counts. */
+
+struct config {
+    const struct policy *policy;
+    int frames;
+    int tlb_size;
+    int tlb_ways;
+    long page_faults;
+    long tlb_hits;
+};
+
+// Shared by the workers, read only apart from next_config.
+struct geometry geometry;
+const int *pages;
+size_t page_count;
+struct config *configs;
+int config_count;
+int next_config = 0;
+pthread_mutex_t next_config_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void *worker(void *arg) {
+    (void)arg;
+    while (1) {
+        pthread_mutex_lock(&next_config_lock);
+        int index = next_config++;
+        pthread_mutex_unlock(&next_config_lock);
+        if (index >= config_count)
+            return NULL;
+
+        struct config *config = &configs[index];
+        struct simulator *sim = sim_create(config->policy, config->frames, geometry.pages, config->tlb_size, config->tlb_ways);
+        sim_prepare(sim, pages, page_count);
+        int faulted;
+        for (size_t i = 0; i < page_count; i++) {
+            sim_translate(sim, pages[i], &faulted);
+        }
+        config->page_faults = sim->page_faults;
+        config->tlb_hits = sim->tlb_hits;
+        sim_destroy(sim);
+    }
+}
+
+// Parses a comma separated list of positive integers into values. Returns their number, or 0 if one is invalid.
+int parse_sizes(char *list, int *values) {
+    int count = 0;
+    for (char *item = strtok(list, ","); item != NULL; item = strtok(NULL, ",")) {
+        int value = atoi(item);
+        if (value < 1 || count == MAX_VALUES)
+            return 0;
+        values[count++] = value;
+    }
+    return count;
+}
+
+void usage(void) {
+    fprintf(stderr, "Usage ./psweep input -p policy,... -f frames,... -t tlb_size,... [-w tlb_ways,...] [-j threads] [-n pages] [-s page_size]\nPolicies:\n");
+    print_policies(stderr);
+    exit(1);
+}
+
+int main(int argc, char *argv[]){
+    const struct policy *policies[MAX_VALUES];
+    int frames[MAX_VALUES];
+    int tlb_sizes[MAX_VALUES];
+    int tlb_ways[MAX_VALUES] = {0};
+    int policy_count = 0, frames_count = 0, tlb_size_count = 0, tlb_ways_count = 1;
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    geometry_defaults(&geometry);
+    if (argc < 2)
+        usage();
+    for (int i = 2; i < argc; i++) {
+        if (i + 1 == argc)
+            usage();
+        char *value = argv[++i];
+        if (!strcmp(argv[i - 1], "-p")) {
+            for (char *name = strtok(value, ","); name != NULL; name = strtok(NULL, ",")) {
+                if (policy_count == MAX_VALUES || (policies[policy_count++] = find_policy(name)) == NULL)
+                    usage();
+            }
+        } else if (!strcmp(argv[i - 1], "-f")) {
+            frames_count = parse_sizes(value, frames);
+        } else if (!strcmp(argv[i - 1], "-t")) {
+            tlb_size_count = parse_sizes(value, tlb_sizes);
+        } else if (!strcmp(argv[i - 1], "-w")) {
+            tlb_ways_count = parse_sizes(value, tlb_ways);
+        } else if (!strcmp(argv[i - 1], "-j")) {
+            threads = atoi(value);
+        } else if (!geometry_option(&geometry, argv[i - 1], value)) {
+            usage();
+        }
+    }
+    if (policy_count == 0 || frames_count == 0 || tlb_size_count == 0 || tlb_ways_count == 0 || threads < 1)
+        usage();
+    // Every configuration must make a valid geometry with the logical pages and page size given.
+    for (int f = 0; f < frames_count; f++) {
+        for (int t = 0; t < tlb_size_count; t++) {
+            for (int w = 0; w < tlb_ways_count; w++) {
+                geometry.frames = frames[f];
+                geometry.tlb_size = tlb_sizes[t];
+                geometry.tlb_ways = tlb_ways[w];
+                if (!geometry_init(&geometry))
+                    exit(1);
+            }
+        }
+    }
+
+    struct trace *trace = trace_open(argv[1]);
+    if (trace == NULL)
+        exit(1);
+    int *trace_pages_array = trace_pages(trace, &geometry, &page_count);
+    pages = trace_pages_array;
+    trace_close(trace);
+    if (trace_pages_array == NULL)
+        exit(1);
+    if (page_count == 0) {
+        fprintf(stderr, "Empty trace %s\n", argv[1]);
+        exit(1);
+    }
+
+    // Configurations in the order of the output: policies, then frames, then TLB sizes, then TLB ways.
+    config_count = policy_count * frames_count * tlb_size_count * tlb_ways_count;
+    configs = calloc(config_count, sizeof(struct config));
+    int index = 0;
+    for (int p = 0; p < policy_count; p++) {
+        for (int f = 0; f < frames_count; f++) {
+            for (int t = 0; t < tlb_size_count; t++) {
+                for (int w = 0; w < tlb_ways_count; w++) {
+                    configs[index].policy = policies[p];
+                    configs[index].frames = frames[f];
+                    configs[index].tlb_size = tlb_sizes[t];
+                    configs[index].tlb_ways = tlb_ways[w];
+                    index++;
+                }
+            }
+        }
+    }
+
+    if (threads > config_count)
+        threads = config_count;
+    pthread_t *pool = malloc(threads * sizeof(pthread_t));
+    for (int i = 0; i < threads; i++) {
+        pthread_create(&pool[i], NULL, worker, NULL);
+    }
+    for (int i = 0; i < threads; i++) {
+        pthread_join(pool[i], NULL);
+    }
+
+    printf("Policy,Frames,TLB Size,TLB Ways,Translated Addresses,Page Faults,Page Fault Rate,TLB Hits,TLB Hit Rate\n");
+    for (int i = 0; i < config_count; i++) {
+        struct config *config = &configs[i];
+        int ways = config->tlb_ways == 0 ? config->tlb_size : config->tlb_ways;
+        printf("%s,%d,%d,%d,%zu,%ld,%.3f,%ld,%.3f\n", config->policy->name, config->frames, config->tlb_size, ways, page_count,
+               config->page_faults, config->page_faults / (1. * page_count),
+               config->tlb_hits, config->tlb_hits / (1. * page_count));
+    }
+
+    free(pool);
+    free(configs);
+    free(trace_pages_array);
+    return 0;
+}
@@ -0,0 +1,161 @@
+#include <stdint.h>
+#include <stdlib.h>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "sim.h"
+
+static int *new_array(int size, int value) {
+    int *array = malloc(size * sizeof(int));
+    for (int i = 0; i < size; i++) {
+        array[i] = value;
+    }
+    return array;
+}
+
+struct simulator *sim_create(const struct policy *policy, int frames, int pages, int tlb_size, int tlb_ways) {
+    struct simulator *sim = calloc(1, sizeof(struct simulator));
+    sim->frames = frames;
+    sim->pages = pages;
+    sim->tlb_size = tlb_size;
+    sim->tlb_ways = tlb_ways == 0 ? tlb_size : tlb_ways;
+    sim->tlb_sets = tlb_size / sim->tlb_ways;
+    sim->policy = policy;
+    sim->policy_state = policy->create(frames, pages);
+
+    // Fill page table entries with -1 for initially empty table.
+    sim->pagetable = new_array(pages, -1);
+    // No frame holds a page or is cached in the TLB yet.
+    sim->frame_page = new_array(frames, -1);
+    sim->frame_tlb = new_array(frames, -1);
+    // Fill tlb entries with -1 for initially empty tlb
+    sim->tlb_logical = (unsigned int *)new_array(tlb_size, -1);
+    sim->tlb_physical = (unsigned int *)new_array(tlb_size, -1);
+    sim->tlb_reference = calloc(tlb_size, 1);
+    sim->tlb_hand = new_array(sim->tlb_sets, 0);
+    return sim;
+}
+
+void sim_destroy(struct simulator *sim) {
+    destroy_policy_state(sim->policy_state);
+    free(sim->pagetable);
+    free(sim->frame_page);
+    free(sim->frame_tlb);
+    free(sim->tlb_logical);
+    free(sim->tlb_physical);
+    free(sim->tlb_reference);
+    free(sim->tlb_hand);
+    free(sim);
+}
+
+void sim_prepare(struct simulator *sim, const int *pages, size_t count) {
+    if (sim->policy->prepare != NULL)
+        sim->policy->prepare(sim->policy_state, pages, count);
+}
+
+// First line of the set a logical page is cached in. Multiplicative hashing spreads consecutive pages over the sets,
+// and the high bits of the product pick the set without a division.
+static int tlb_set_start(const struct simulator *sim, unsigned int logical_page) {
+    uint32_t hash = logical_page * 0x9E3779B1u;
+    return (int)(((uint64_t)hash * sim->tlb_sets) >> 32) * sim->tlb_ways;
+}
+
+// Index of the line among the ways lines from first whose tag is logical_page, or -1. A page is cached at most once,
+// so the lines are compared several at a time and the first match is the only one.
+static int find_line(const unsigned int *tags, int first, int ways, unsigned int logical_page) {
+    int i = 0;
+#if defined(__AVX2__)
+    __m256i key = _mm256_set1_epi32(logical_page);
+    for (; i + 8 <= ways; i += 8) {
+        __m256i line = _mm256_loadu_si256((const __m256i *)(tags + first + i));
+        int mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(line, key)));
+        if (mask)
+            return first + i + __builtin_ctz(mask);
+    }
+#elif defined(__SSE2__)
+    __m128i key = _mm_set1_epi32(logical_page);
+    for (; i + 4 <= ways; i += 4) {
+        __m128i line = _mm_loadu_si128((const __m128i *)(tags + first + i));
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(line, key)));
+        if (mask)
+            return first + i + __builtin_ctz(mask);
+    }
+#endif
+    for (; i < ways; i++) {
+        if (tags[first + i] == logical_page)
+            return first + i;
+    }
+    return -1;
+}
+
+static int search_tlb(struct simulator *sim, unsigned int logical_page) {
+    int line = find_line(sim->tlb_logical, tlb_set_start(sim, logical_page), sim->tlb_ways, logical_page);
+    if (line == -1)
+        return -1; // Not found in TLB
+    sim->tlb_reference[line] = 1; // Set the reference bit to 1 for the page
+    return sim->tlb_physical[line]; // Return the physical page number for the logical page
+}
+
+static void add_to_tlb(struct simulator *sim, unsigned int logical, unsigned int physical) { // Add a new entry to the set of the page
+    int first = tlb_set_start(sim, logical);
+    int *hand = &sim->tlb_hand[first / sim->tlb_ways];
+    while (1) {
+        int index = first + *hand;
+        *hand = (*hand + 1) % sim->tlb_ways; // Move to next line of the set
+        if (sim->tlb_reference[index] == 0) { // If the reference bit is 0, we can evict this line
+            if (sim->tlb_physical[index] < (unsigned int)sim->frames) // The frame cached by the overwritten line is no longer in the TLB
+                sim->frame_tlb[sim->tlb_physical[index]] = -1;
+            sim->frame_tlb[physical] = index;
+            sim->tlb_logical[index] = logical;
+            sim->tlb_physical[index] = physical;
+            sim->tlb_reference[index] = 1; // Set the reference bit to 1 for the new entry
+            break;  // We're done adding to the TLB
+        }
+        sim->tlb_reference[index] = 0; // Clear reference bit if it's set
+    }
+}
+
+int sim_translate(struct simulator *sim, int logical_page, int *faulted) {
+    sim->total_addresses++;
+    *faulted = 0;
+    int physical_page = search_tlb(sim, logical_page);
+    // TLB hit
+    if (physical_page != -1) {
+        sim->tlb_hits++;
+        sim->policy->on_access(sim->policy_state, logical_page, physical_page);
+        return physical_page;
+    }
+    // TLB miss
+    physical_page = sim->pagetable[logical_page];
+    if (physical_page == -1) {
+        // frame that will receive the page: the next free one until the memory is full, then a victim
+        int frame = sim->free_page;
+        if (sim->free_page >= sim->frames) {
+            frame = sim->policy->choose_victim(sim->policy_state, logical_page);
+            // Remove the evicted page from the page table and the TLB through the reverse maps.
+            sim->pagetable[sim->frame_page[frame]] = -1;
+            if (sim->frame_tlb[frame] != -1) {
+                sim->tlb_logical[sim->frame_tlb[frame]] = -1;
+                sim->tlb_physical[sim->frame_tlb[frame]] = -1;
+                sim->frame_tlb[frame] = -1;
+            }
+        } else {
+            sim->free_page++;
+        }
+        // save the physical page number at the pagetable, and the owner of the frame in the reverse map
+        sim->pagetable[logical_page] = frame;
+        sim->frame_page[frame] = logical_page;
+        physical_page = frame;
+        // a page fault occured, increment page fault counter
+        sim->page_faults++;
+        *faulted = 1;
+    }
+    add_to_tlb(sim, logical_page, physical_page);
+    // let the replacement policy know about the reference
+    if (*faulted)
+        sim->policy->on_fault(sim->policy_state, logical_page, physical_page);
+    else
+        sim->policy->on_access(sim->policy_state, logical_page, physical_page);
+    return physical_page;
+}
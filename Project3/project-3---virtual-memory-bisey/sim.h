@@ -0,0 +1,53 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include "policy.h"
+
+// Address translation of one configuration: TLB, page table and replacement policy, without the memory contents.
+// All of it lives in this structure, so simulations of different configurations can run in parallel.
+struct simulator {
+    int frames;
+    int pages;
+    int tlb_size;
+    int tlb_ways; // lines per set, tlb_size for a fully associative TLB
+    int tlb_sets;
+    const struct policy *policy;
+    void *policy_state;
+
+    // The TLB is tlb_sets sets of tlb_ways lines, one set after the other, stored as one array per field so a set
+    // can be searched with vector compares. A page can only be cached in the set its number hashes to. Each set is
+    // kept track of as a circular array, with the oldest line being overwritten once the set is full (second chance).
+    unsigned int *tlb_logical; // logical page of each line, -1 if the line is empty
+    unsigned int *tlb_physical;
+    unsigned char *tlb_reference; // Reference bit for second chance
+    // tlb_hand[set] is the index, within the set, of the next line to consider for replacement
+    int *tlb_hand;
+
+    // pagetable[logical_page] is the physical page number for logical page. Value is -1 if that logical page isn't yet in the table.
+    int *pagetable;
+    // Reverse maps, so an eviction finds what refers to its frame without scanning the page table or the TLB.
+    // frame_page[frame] is the logical page held by the frame, or -1 if the frame is still free.
+    int *frame_page;
+    // frame_tlb[frame] is the TLB line caching the frame, or -1 if no line does.
+    int *frame_tlb;
+    // Number of the next unallocated physical page in main memory
+    int free_page;
+
+    // Data we need to keep track of to compute stats at end.
+    long total_addresses;
+    long tlb_hits;
+    long page_faults;
+};
+
+// tlb_ways is the associativity of the TLB, which must divide tlb_size; 0 makes it fully associative.
+struct simulator *sim_create(const struct policy *policy, int frames, int pages, int tlb_size, int tlb_ways);
+void sim_destroy(struct simulator *sim);
+
+// Hands the logical page of every reference of the trace to an offline policy; does nothing for the others.
+void sim_prepare(struct simulator *sim, const int *pages, size_t count);
+
+// Translates a reference to a logical page and returns its frame. Sets *faulted if the page had to be loaded into
+// the frame, in which case the caller fills it.
+int sim_translate(struct simulator *sim, int logical_page, int *faulted);
+
+#endif // SIM_H
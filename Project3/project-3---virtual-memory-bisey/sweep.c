@@ -0,0 +1,156 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "geometry.h"
+#include "trace.h"
+
+// Default of the largest TLB to report; the largest main memory defaults to one frame per logical page.
+#define MAX_TLB_SIZE 64
+
+/* Sizing sweep: one pass over a trace gives the number of page faults of an LRU main memory for every number of
+ * frames, and the number of hits of an LRU TLB for every TLB size (part2 uses second chance in its TLB, so its TLB
+ * hits differ a little).
+ *
+ * The stack distance of a reference is the number of distinct pages referenced since the previous reference to the
+ * same page (Mattson et al.). LRU with F frames hits exactly the references whose distance is below F, so a histogram
+ * of distances answers every F at once. A TLB of T <= F lines never holds a page that LRU evicted from memory, so
+ * with enough frames it hits the references whose distance is below T.
+ *
+ * Distances are counted with a Fenwick tree over time: every page marks the time of its last reference, and the
+ * distance is the number of marks after the previous reference to the page. There are at most as many marks as logical
+ * pages, so when the tree is full they are renumbered from 0 in order, which keeps its size at twice the number of
+ * pages for any trace length. */
+int tree_size; // 2 * pages
+int *tree; // Fenwick tree over times 1..tree_size
+int *owner; // page whose last reference is at that time, or -1
+int *last; // time of the last reference to each page, or -1
+int now = 0; // time of the next reference
+int marks = 0; // number of marked times, i.e. of distinct pages seen
+
+void tree_add(int time, int delta) {
+    for (int i = time + 1; i <= tree_size; i += i & -i) {
+        tree[i] += delta;
+    }
+}
+
+// Number of marks at times 0..time.
+int tree_prefix(int time) {
+    int sum = 0;
+    for (int i = time + 1; i > 0; i -= i & -i) {
+        sum += tree[i];
+    }
+    return sum;
+}
+
+// Renumber the marked times 0..marks-1, keeping their order, and rebuild the tree in O(tree_size).
+void compact(void) {
+    int time = 0;
+    memset(tree, 0, (tree_size + 1) * sizeof(int));
+    for (int i = 0; i < tree_size; i++) {
+        if (owner[i] == -1)
+            continue;
+        int page = owner[i];
+        owner[i] = -1;
+        owner[time] = page;
+        last[page] = time;
+        tree[time + 1] = 1;
+        time++;
+    }
+    for (int i = 1; i <= tree_size; i++) { // linear Fenwick construction
+        int parent = i + (i & -i);
+        if (parent <= tree_size)
+            tree[parent] += tree[i];
+    }
+    now = time;
+}
+
+// Returns the stack distance of a reference to page, or -1 for its first reference.
+int reference(int page) {
+    if (now == tree_size)
+        compact();
+    int distance = -1;
+    if (last[page] != -1) {
+        distance = marks - tree_prefix(last[page]);
+        tree_add(last[page], -1);
+        owner[last[page]] = -1;
+    } else {
+        marks++;
+    }
+    tree_add(now, 1);
+    owner[now] = page;
+    last[page] = now++;
+    return distance;
+}
+
+int main(int argc, const char *argv[]){
+    // -f and -t give the largest main memory and TLB to report.
+    struct geometry geometry;
+    geometry_defaults(&geometry);
+    geometry.frames = 0;
+    geometry.tlb_size = MAX_TLB_SIZE;
+    int usage = argc < 2 || argc % 2 == 1;
+    for (int i = 2; !usage && i < argc; i += 2) {
+        usage = !strcmp(argv[i], "-w") || !geometry_option(&geometry, argv[i], argv[i + 1]);
+    }
+    if (usage) {
+        fprintf(stderr, "Usage ./sweep input [-f max_frames] [-t max_tlb_size] [-n pages] [-s page_size]\n");
+        exit(1);
+    }
+    if (geometry.frames == 0)
+        geometry.frames = geometry.pages;
+    if (!geometry_init(&geometry))
+        exit(1);
+    int max_frames = geometry.frames;
+    int max_tlb_size = geometry.tlb_size;
+    if (max_tlb_size > geometry.pages) {
+        fprintf(stderr, "The TLB cannot have more lines than there are pages\n");
+        exit(1);
+    }
+    struct trace *trace = trace_open(argv[1]);
+    if (trace == NULL)
+        exit(1);
+
+    tree_size = 2 * geometry.pages;
+    tree = calloc(tree_size + 1, sizeof(int));
+    owner = malloc(tree_size * sizeof(int));
+    last = malloc(geometry.pages * sizeof(int));
+    for (int i = 0; i < tree_size; i++) {
+        owner[i] = -1;
+    }
+    for (int i = 0; i < geometry.pages; i++) {
+        last[i] = -1;
+    }
+
+    // histogram[d] is the number of references at stack distance d; first references always fault.
+    long *histogram = calloc(geometry.pages, sizeof(long));
+    long total_addresses = 0;
+    uint64_t address;
+    while (trace_next(trace, &address)) {
+        total_addresses++;
+        int distance = reference(geometry_page(&geometry, address));
+        if (distance != -1)
+            histogram[distance]++;
+    }
+    trace_close(trace);
+
+    printf("Number of Translated Addresses = %ld\n", total_addresses);
+    printf("Frames,Page Faults,Page Fault Rate\n");
+    long hits = 0;
+    for (int frames = 1; frames <= max_frames; frames++) {
+        hits += histogram[frames - 1];
+        long faults = total_addresses - hits;
+        printf("%d,%ld,%.3f\n", frames, faults, faults / (1. * total_addresses));
+    }
+    printf("TLB Size,TLB Hits,TLB Hit Rate\n");
+    hits = 0;
+    for (int size = 1; size <= max_tlb_size; size++) {
+        hits += histogram[size - 1];
+        printf("%d,%ld,%.3f\n", size, hits, hits / (1. * total_addresses));
+    }
+    free(histogram);
+    free(last);
+    free(owner);
+    free(tree);
+    return 0;
+}
@@ -0,0 +1,173 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "trace.h"
+
+// Longest line of a text trace: a 64-bit address has at most 20 digits.
+#define LINE_SIZE 32
+
+struct trace {
+    FILE *text; // text trace, or NULL for a binary one
+    const unsigned char *map; // whole binary trace file
+    size_t map_size;
+    int format;
+    uint64_t count; // number of addresses of a binary trace
+    uint64_t index; // number of addresses read so far
+    const unsigned char *next; // next byte to decode in a TRACE_VARINT trace
+    uint64_t previous; // last address read from a TRACE_VARINT trace
+    int is_corrupted; // set once a TRACE_VARINT address could not be decoded
+};
+
+struct trace *trace_open(const char *filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Cannot open trace %s\n", filename);
+        return NULL;
+    }
+    struct trace *trace = calloc(1, sizeof(struct trace));
+    struct trace_header header;
+    if (read(fd, &header, sizeof(header)) != sizeof(header) || memcmp(header.magic, TRACE_MAGIC, 4)) {
+        // No binary header, read it as text.
+        close(fd);
+        trace->text = fopen(filename, "r");
+        return trace;
+    }
+
+    struct stat st;
+    fstat(fd, &st);
+    trace->map_size = st.st_size;
+    trace->map = mmap(0, trace->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (trace->map == MAP_FAILED) {
+        fprintf(stderr, "Cannot map trace %s\n", filename);
+        free(trace);
+        return NULL;
+    }
+    madvise((void *)trace->map, trace->map_size, MADV_SEQUENTIAL);
+    trace->format = header.format;
+    trace->count = header.count;
+
+    // The addresses of fixed size formats must all be there; a varint takes at least a byte and is checked while
+    // decoding. Divide rather than multiply, so a corrupted count cannot overflow.
+    size_t element_size = trace->format == TRACE_U32 ? sizeof(uint32_t) : trace->format == TRACE_U64 ? sizeof(uint64_t) : 1;
+    if (trace->format > TRACE_VARINT || trace->count > (trace->map_size - sizeof(header)) / element_size) {
+        fprintf(stderr, "Corrupted trace %s\n", filename);
+        trace_close(trace);
+        return NULL;
+    }
+    trace_rewind(trace);
+    return trace;
+}
+
+int trace_next(struct trace *trace, uint64_t *address) {
+    if (trace->text != NULL) {
+        char line[LINE_SIZE];
+        if (fgets(line, LINE_SIZE, trace->text) == NULL)
+            return 0;
+        *address = strtoull(line, NULL, 10);
+        return 1;
+    }
+    if (trace->index == trace->count)
+        return 0;
+    const unsigned char *data = trace->map + sizeof(struct trace_header);
+    if (trace->format == TRACE_U32) {
+        uint32_t value;
+        memcpy(&value, data + trace->index * sizeof(value), sizeof(value));
+        *address = value;
+    } else if (trace->format == TRACE_U64) {
+        memcpy(address, data + trace->index * sizeof(uint64_t), sizeof(uint64_t));
+    } else {
+        const unsigned char *end = trace->map + trace->map_size;
+        uint64_t zigzag = 0;
+        int shift = 0;
+        while (1) {
+            // A 64-bit value takes at most 10 bytes.
+            if (trace->next == end || shift > 63) {
+                fprintf(stderr, "Corrupted trace: address %llu is %s\n", (unsigned long long)trace->index,
+                        trace->next == end ? "truncated" : "too long");
+                trace->is_corrupted = 1;
+                trace->index = trace->count;
+                return 0;
+            }
+            unsigned char byte = *trace->next++;
+            zigzag |= (uint64_t)(byte & 0x7F) << shift;
+            if (!(byte & 0x80))
+                break;
+            shift += 7;
+        }
+        int64_t delta = (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+        trace->previous += delta;
+        *address = trace->previous;
+    }
+    trace->index++;
+    return 1;
+}
+
+void trace_rewind(struct trace *trace) {
+    if (trace->text != NULL) {
+        rewind(trace->text);
+        return;
+    }
+    trace->index = 0;
+    trace->next = trace->map + sizeof(struct trace_header);
+    trace->previous = 0;
+}
+
+void trace_close(struct trace *trace) {
+    if (trace->text != NULL)
+        fclose(trace->text);
+    else
+        munmap((void *)trace->map, trace->map_size);
+    free(trace);
+}
+
+int *trace_pages(struct trace *trace, const struct geometry *geometry, size_t *count) {
+    size_t capacity = trace->text == NULL && trace->count > 0 ? trace->count : 1024;
+    int *pages = capacity <= SIZE_MAX / sizeof(int) ? malloc(capacity * sizeof(int)) : NULL;
+    uint64_t address;
+    *count = 0;
+    trace_rewind(trace);
+    while (pages != NULL && trace_next(trace, &address)) {
+        if (*count == capacity) {
+            int *grown = capacity <= SIZE_MAX / 2 / sizeof(int) ? realloc(pages, 2 * capacity * sizeof(int)) : NULL;
+            if (grown == NULL) {
+                free(pages);
+                pages = NULL;
+                break;
+            }
+            pages = grown;
+            capacity *= 2;
+        }
+        pages[(*count)++] = geometry_page(geometry, address);
+    }
+    trace_rewind(trace);
+    if (pages == NULL)
+        fprintf(stderr, "Not enough memory for the pages of the trace\n");
+    if (trace->is_corrupted) {
+        free(pages);
+        pages = NULL;
+    }
+    return pages;
+}
+
+void trace_write(FILE *fp, int format, uint64_t address, uint64_t previous) {
+    if (format == TRACE_U32) {
+        uint32_t value = address;
+        fwrite(&value, sizeof(value), 1, fp);
+    } else if (format == TRACE_U64) {
+        fwrite(&address, sizeof(address), 1, fp);
+    } else {
+        int64_t delta = address - previous;
+        uint64_t zigzag = ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63);
+        while (zigzag >= 0x80) {
+            fputc((zigzag & 0x7F) | 0x80, fp);
+            zigzag >>= 7;
+        }
+        fputc(zigzag, fp);
+    }
+}
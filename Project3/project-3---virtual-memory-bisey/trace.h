@@ -0,0 +1,50 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "geometry.h"
+
+// A trace is either a text file with one decimal address per line, like addresses.txt, or a binary trace written by
+// tracecvt. A binary trace is a header followed by the addresses, all little endian:
+//   magic "VMT1", u32 format, u64 number of addresses
+//   TRACE_U32:    one u32 per address
+//   TRACE_U64:    one u64 per address
+//   TRACE_VARINT: per address, the difference with the previous one (the first with 0), zigzag encoded, as a LEB128
+//                 varint: 7 bits per byte, low bits first, high bit set on all bytes but the last
+// Binary traces are mapped in memory and decoded in place.
+#define TRACE_MAGIC "VMT1"
+#define TRACE_U32 0
+#define TRACE_U64 1
+#define TRACE_VARINT 2
+
+struct trace_header {
+    char magic[4];
+    uint32_t format;
+    uint64_t count;
+};
+
+struct trace;
+
+// Opens a text or binary trace. Prints an error and returns NULL if it cannot be read.
+struct trace *trace_open(const char *filename);
+
+// Reads the next address. Returns 0 at the end of the trace, or after printing an error if the trace is corrupted.
+int trace_next(struct trace *trace, uint64_t *address);
+
+// Goes back to the first address.
+void trace_rewind(struct trace *trace);
+
+void trace_close(struct trace *trace);
+
+// Reads the whole trace into an array of the logical pages of its addresses, and rewinds it.
+// Returns the array, to be freed, and its length in *count. Prints an error and returns NULL if it does not fit in
+// memory or the trace is corrupted.
+int *trace_pages(struct trace *trace, const struct geometry *geometry, size_t *count);
+
+// Appends an address to a binary trace being written, in the given format. previous is the last address written
+// (0 before the first one), needed by TRACE_VARINT.
+void trace_write(FILE *fp, int format, uint64_t address, uint64_t previous);
+
+#endif // TRACE_H
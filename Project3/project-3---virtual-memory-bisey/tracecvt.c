@@ -0,0 +1,55 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+// Converts a trace, usually a text one like addresses.txt, into a binary trace that part2 reads much faster.
+int main(int argc, const char *argv[]){
+    int format = TRACE_U32;
+    if (argc == 4 && !strcmp(argv[3], "u64"))
+        format = TRACE_U64;
+    else if (argc == 4 && !strcmp(argv[3], "varint"))
+        format = TRACE_VARINT;
+    else if (argc != 3 && !(argc == 4 && !strcmp(argv[3], "u32"))) {
+        fprintf(stderr, "Usage ./tracecvt input output [u32|u64|varint]\n");
+        exit(1);
+    }
+
+    struct trace *trace = trace_open(argv[1]);
+    if (trace == NULL)
+        exit(1);
+    FILE *output_fp = fopen(argv[2], "wb");
+    if (output_fp == NULL) {
+        fprintf(stderr, "Cannot create %s\n", argv[2]);
+        exit(1);
+    }
+
+    // The header is written again at the end, once the number of addresses is known.
+    struct trace_header header;
+    memcpy(header.magic, TRACE_MAGIC, 4);
+    header.format = format;
+    header.count = 0;
+    fwrite(&header, sizeof(header), 1, output_fp);
+
+    uint64_t address, previous = 0;
+    while (trace_next(trace, &address)) {
+        if (format == TRACE_U32 && address > UINT32_MAX) {
+            fprintf(stderr, "Address %llu does not fit in u32, use u64 or varint\n", (unsigned long long)address);
+            exit(1);
+        }
+        trace_write(output_fp, format, address, previous);
+        previous = address;
+        header.count++;
+    }
+    trace_close(trace);
+
+    fseek(output_fp, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, output_fp);
+    if (fclose(output_fp) != 0) {
+        fprintf(stderr, "Cannot write %s\n", argv[2]);
+        exit(1);
+    }
+    printf("Converted %llu addresses\n", (unsigned long long)header.count);
+    return 0;
+}